@@ -1,276 +1,2916 @@
+#define _GNU_SOURCE
 #include <assert.h>
+#include <ctype.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <lzma.h>
+#include <zlib.h>
 
 #define SV_IMPLEMENTATION
-#include "sv.h"
+#define MSG_IMPLEMENTATION
+#include "msg.h"
 
-static char const* program_name;
-static char const* manpage_path = "index.1";
-static char const* theme = "theme.css";
-static char const* background_color = "300";
-static char const* text_color = "45";
-static char const* accent_color = "168";
+// Everything needed to build one site. Sites don't share mutable state,
+// so several of them can be rendered at the same time by one process.
+typedef struct site
+{
+	char const* path;
+	char const* theme_path;
+	char const* output_dir;
+	char const* stylesheet_dir;
+	// Root of manpath tree that pages are found in, pages are rendered into the same layout
+	char const* manpath;
+	// Path of shared stylesheet relative to output directory, or to current directory without one
+	char stylesheet_href[PATH_MAX];
+	bool print_stats;
+	bool build_index;
+	Msg_Config config;
+
+	// Formats every page is rendered to from single parse, HTML by default
+	Msg_Format formats[Msg_Formats];
+	size_t formats_count;
+	// Formats of one page are rendered by threads of their own, which pays off
+	// only when there are fewer pages than jobs to keep them busy
+	bool parallel_formats;
+
+	// Filled by build for every page, slot per page so workers don't synchronize
+	Index_Entry *index;
+
+	char const** pages;
+	size_t pages_count;
+	size_t pages_capacity;
+} Site;
+
+typedef struct sites
+{
+	Site *sites;
+	size_t sites_count;
+	size_t sites_capacity;
+} Sites;
+
+typedef enum {
+	Io_Auto,
+	Io_Stdio,
+	Io_Uring,
+} Io_Backend;
+
+enum {
+	Read_Ok,
+	Read_Open_Failed = 3,
+	Read_Failed = 4,
+	Read_Corrupted,
+};
+
+// Roff input parsed and rendered by all threads and time they spent on it, reported by --stats
+typedef struct throughput
+{
+	uint64_t bytes;
+	uint64_t ns;
+} Throughput;
+
+static Throughput throughput;
+
+typedef enum {
+	Compression_None,
+	Compression_Gzip,
+	Compression_Xz,
+} Compression;
+
+static String_View read_entire_file(char const* filename);
+static int read_file(char const* filename, String_View *content);
+static char const* read_error(int status);
+static bool decompress(String_View *content);
+static char const* read_include_file(char const* path, String_View *content);
+static String_View page_name(char const* path);
+static String_View page_directory(Site const* site, char const* path);
+static Site default_site();
+static Index_Entry index_entry_for(Site const* site, Page const* page);
+static void load_site_file(Site *site, char const* path);
+static char const* trim_slashes(char *path);
+static void prepare_site(Site *site);
+static bool parse_formats(Site *site, String_View names);
+static void output_path_for(Site const* site, char const* page_path, size_t part, char const* extension, char *buffer, size_t size);
+static bool render_source(Site const* site, char const* path, String_View src, Index_Entry *entry, Page *page, Output *outs);
+static void write_page_parts(Site const* site, Msg_Config const* config, Page const* page, Output *out);
+static void page_config(Site const* site, char const* page_path, Msg_Config *config, char *href, size_t size);
+static void build_page(Site const* site, char const* path, Index_Entry *entry);
+static void write_index(Site const* site, long jobs);
+static void write_site_file(Site const* site, char const* name, Output *out);
+static void write_sitemap(Site const* site, size_t count);
+static void write_whatis(Site const* site, size_t count);
+static int apropos(char const* database, char const* term);
+static void parallel_sort(void *base, size_t count, size_t size, int (*compare)(void const*, void const*), long jobs);
+static void build_sites(Sites const* sites, long jobs);
+static void build_manpath(Site *site, long jobs);
+static bool build_with_uring(Site const* site);
+static void serve(Site const* site, char const* socket_path, long jobs);
+static void load_test(char const* socket_path, char const* page_path, size_t requests, long jobs);
+typedef enum {
+	Summary_Text,
+	Summary_Json,
+	Summary_Binary,
+} Summary_Format;
+
+static void summary(Page const* page, Summary_Format format);
+static int format_diagnostic(Msg_Diagnostic const* diagnostic, char *buffer, size_t size);
+static void print_diagnostic(void *data, Msg_Diagnostic const* diagnostic);
+static void batch_diagnostic(void *data, Msg_Diagnostic const* diagnostic);
+static void batch_failure(char const* path, int status, char const* fmt, ...);
+static int report_diagnostics();
+static Page read_page(Site const* site, char const* path, String_View src);
+static bool write_all(int fd, char const* data, size_t size);
+static void write_output(Output *out, int fd, char const* path);
+static void load_theme(Site *site);
+static void write_stylesheet(Site *site);
+static uint64_t fnv1a(String_View data);
+static uint64_t now_ns();
+static void print_throughput(char const* path);
+static void usage(char const* program_name);
+
+int main(int argc, char **argv)
+{
+	char const* program_name = *argv;
+	assert(program_name);
+
+	Site site = default_site();
+	Sites sites = {0};
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	Io_Backend io_backend = Io_Auto;
+
+	bool print_summary = false;
+	Summary_Format summary_format = Summary_Text;
+	char const* daemon_socket = NULL;
+	char const* load_test_socket = NULL;
+	size_t load_test_requests = 10000;
+	char const* apropos_term = NULL;
+	for (int i = 1; --argc; ++i) {
+		if (argv[i][0] == '-') {
+			if (strcmp("-h", argv[i]) == 0) {
+				usage(program_name);
+			}
+			if (strcmp("-s", argv[i]) == 0) {
+				print_summary = true;
+				continue;
+			}
+			if (strncmp("--format=", argv[i], 9) == 0) {
+				char const* name = argv[i] + 9;
+				if (strcmp(name, "text") == 0)        summary_format = Summary_Text;
+				else if (strcmp(name, "json") == 0)   summary_format = Summary_Json;
+				else if (strcmp(name, "binary") == 0) summary_format = Summary_Binary;
+				else {
+					fprintf(stderr, "error: unknown summary format: %s\n", name);
+					return 2;
+				}
+				continue;
+			}
+			if (strncmp("--to=", argv[i], 5) == 0) {
+				if (!parse_formats(&site, sv_from_cstr(argv[i] + 5))) {
+					fprintf(stderr, "error: unknown output format in: %s\n", argv[i] + 5);
+					return 2;
+				}
+				continue;
+			}
+			if (strcmp("--minify", argv[i]) == 0) {
+				site.config.minify = true;
+				continue;
+			}
+			if (strcmp("--toc", argv[i]) == 0) {
+				site.config.toc = true;
+				continue;
+			}
+			if (strcmp("--no-index", argv[i]) == 0) {
+				site.build_index = false;
+				continue;
+			}
+			if (strcmp("--stats", argv[i]) == 0) {
+				site.print_stats = true;
+				continue;
+			}
+			if (strcmp("--manpath", argv[i]) == 0) {
+				if (!--argc) {
+					fprintf(stderr, "error: %s expects directory argument\n", argv[i]);
+					return 2;
+				}
+				site.manpath = trim_slashes(argv[++i]);
+				continue;
+			}
+			if (strcmp("-o", argv[i]) == 0 || strcmp("--out", argv[i]) == 0) {
+				if (!--argc) {
+					fprintf(stderr, "error: %s expects directory argument\n", argv[i]);
+					return 2;
+				}
+				site.output_dir = argv[++i];
+				continue;
+			}
+			if (strncmp("--io=", argv[i], 5) == 0) {
+				char const* name = argv[i] + 5;
+				if (strcmp(name, "auto") == 0)       io_backend = Io_Auto;
+				else if (strcmp(name, "stdio") == 0) io_backend = Io_Stdio;
+				else if (strcmp(name, "uring") == 0) io_backend = Io_Uring;
+				else {
+					fprintf(stderr, "error: unknown I/O backend: %s\n", name);
+					return 2;
+				}
+				continue;
+			}
+			if (strcmp("--max-bytes", argv[i]) == 0 || strcmp("--max-commands", argv[i]) == 0) {
+				char const* option = argv[i];
+				size_t *budget = option[6] == 'b' ? &site.config.max_bytes : &site.config.max_commands;
+				if (!--argc || (*budget = atol(argv[++i])) == 0) {
+					fprintf(stderr, "error: %s expects positive number\n", option);
+					return 2;
+				}
+				continue;
+			}
+			if (strcmp("-j", argv[i]) == 0) {
+				if (!--argc || (jobs = atol(argv[++i])) <= 0) {
+					fprintf(stderr, "error: -j expects positive number of jobs\n");
+					return 2;
+				}
+				continue;
+			}
+			if (strcmp("--daemon", argv[i]) == 0 || strcmp("--load-test", argv[i]) == 0) {
+				if (!--argc) {
+					fprintf(stderr, "error: %s expects socket path argument\n", argv[i]);
+					return 2;
+				}
+				*(argv[i][2] == 'd' ? &daemon_socket : &load_test_socket) = argv[i+1];
+				++i;
+				continue;
+			}
+			if (strcmp("--apropos", argv[i]) == 0) {
+				if (!--argc) {
+					fprintf(stderr, "error: %s expects search term argument\n", argv[i]);
+					return 2;
+				}
+				apropos_term = argv[++i];
+				continue;
+			}
+			if (strcmp("-n", argv[i]) == 0) {
+				if (!--argc || (load_test_requests = atol(argv[++i])) == 0) {
+					fprintf(stderr, "error: -n expects positive number of requests\n");
+					return 2;
+				}
+				continue;
+			}
+			if (strcmp("--base-url", argv[i]) == 0) {
+				if (!--argc) {
+					fprintf(stderr, "error: %s expects URL argument\n", argv[i]);
+					return 2;
+				}
+				site.config.base_url = trim_slashes(argv[++i]);
+				continue;
+			}
+			if (strcmp("--external-theme", argv[i]) == 0) {
+				if (!--argc) {
+					fprintf(stderr, "error: %s expects directory argument\n", argv[i]);
+					return 2;
+				}
+				site.stylesheet_dir = argv[++i];
+				continue;
+			}
+			if (strcmp("--site", argv[i]) == 0) {
+				if (!--argc) {
+					fprintf(stderr, "error: %s expects site configuration argument\n", argv[i]);
+					return 2;
+				}
+				// Options given so far are defaults for the site
+				Push(sites, sites);
+				*Back(sites, sites) = site;
+				Back(sites, sites)->pages = NULL;
+				Back(sites, sites)->pages_count = Back(sites, sites)->pages_capacity = 0;
+				load_site_file(Back(sites, sites), argv[++i]);
+				continue;
+			}
+			fprintf(stderr, "error: unrecognized parameter: %s\n", argv[i]);
+			return 2;
+		}
+
+		Push(site, pages);
+		*Back(site, pages) = argv[i];
+		if (!site.output_dir) {
+			// Only one page can be rendered to standard output
+			break;
+		}
+	}
+
+	// Large pages are split between the same number of threads as pages
+	site.config.jobs = jobs;
+	site.parallel_formats = site.pages_count < (size_t)jobs;
+	for (size_t i = 0; i < sites.sites_count; ++i) {
+		sites.sites[i].config.jobs = jobs;
+		sites.sites[i].parallel_formats = sites.sites[i].pages_count < (size_t)jobs;
+	}
+
+	if (apropos_term) {
+		return apropos(site.pages_count ? site.pages[0] : "whatis.db", apropos_term);
+	}
+
+	if (load_test_socket) {
+		load_test(load_test_socket, site.pages_count ? site.pages[0] : "index.1", load_test_requests, jobs);
+		return 0;
+	}
+
+	if (daemon_socket) {
+		prepare_site(&site);
+		serve(&site, daemon_socket, jobs);
+		return 0;
+	}
+
+	if (site.manpath) {
+		if (!site.output_dir || site.pages_count > 0 || sites.sites_count > 0) {
+			fprintf(stderr, "error: --manpath needs output directory --out and can't be combined with manpages or --site\n");
+			return 2;
+		}
+		site.config.diagnostic = batch_diagnostic;
+		// Manpath has enough pages for all jobs
+		site.parallel_formats = false;
+		prepare_site(&site);
+		build_manpath(&site, jobs);
+		write_index(&site, jobs);
+		print_throughput("total");
+		return report_diagnostics();
+	}
+
+	if (print_summary && (site.output_dir || sites.sites_count)) {
+		fprintf(stderr, "error: -s cannot be combined with -o or --site\n");
+		return 2;
+	}
+
+	if (site.output_dir) {
+		Push(sites, sites);
+		*Back(sites, sites) = site;
+	} else if (sites.sites_count > 0 && site.pages_count > 0) {
+		fprintf(stderr, "error: manpages given with --site need output directory -o\n");
+		return 2;
+	}
+
+	if (sites.sites_count > 0) {
+		for (size_t i = 0; i < sites.sites_count; ++i) {
+			// Pages with errors are skipped and reported after build, together with warnings
+			sites.sites[i].config.diagnostic = batch_diagnostic;
+			prepare_site(&sites.sites[i]);
+		}
+		// Pages written with io_uring have single output
+		bool single = sites.sites_count == 1 && sites.sites[0].formats_count == 1;
+		if (io_backend == Io_Stdio || !single || !build_with_uring(&sites.sites[0])) {
+			if (io_backend == Io_Uring) {
+				fprintf(stderr, "error: io_uring is not available%s\n", single ? "" : " for multiple sites or formats");
+				return 2;
+			}
+			build_sites(&sites, jobs);
+		}
+		for (size_t i = 0; i < sites.sites_count; ++i) {
+			write_index(&sites.sites[i], jobs);
+		}
+		print_throughput("total");
+		return report_diagnostics();
+	}
+
+	if (site.formats_count > 1) {
+		fprintf(stderr, "error: several output formats need output directory -o\n");
+		return 2;
+	}
+
+	char const* manpage_path = site.pages_count ? site.pages[0] : "index.1";
+	Page page = read_page(&site, manpage_path, read_entire_file(manpage_path));
+
+	if (print_summary) {
+		summary(&page, summary_format);
+	} else {
+		prepare_site(&site);
+		uint64_t start = now_ns();
+		Output out = {0};
+		render_page_as(&site.config, site.formats[0], &page, &out);
+		throughput.ns = now_ns() - start;
+		throughput.bytes = page.source.count;
+		write_output(&out, STDOUT_FILENO, "-");
+		if (site.print_stats) {
+			fprintf(stderr, "%s: minification saved %zu bytes\n", page.path, out.minify_saved);
+			print_throughput(page.path);
+		}
+	}
+
+	return 0;
+}
+
+static Site default_site()
+{
+	Site site = {
+		.theme_path = "theme.css",
+		.build_index = true,
+		.config = msg_default_config(),
+		.formats = { Msg_Html },
+		.formats_count = 1,
+	};
+	site.config.diagnostic = print_diagnostic;
+	site.config.read_include = read_include_file;
+	return site;
+}
+
+// Loads site configuration from INI like file with `key = value` lines.
+// Lines starting with # or ; and [section] headers are ignored.
+static void load_site_file(Site *site, char const* path)
+{
+	String_View src = read_entire_file(path);
+	site->path = path;
+
+	for (size_t line_number = 1; src.count > 0; ++line_number) {
+		String_View line = sv_trim(sv_chop_by_delim(&src, '\n'));
+		if (line.count == 0 || *line.data == '#' || *line.data == ';' || *line.data == '[') {
+			continue;
+		}
+
+		String_View key = sv_trim(sv_chop_by_delim(&line, '='));
+		String_View value = sv_trim(line);
+		// Buffer is owned by site, so values are terminated in place
+		((char*)value.data)[value.count] = '\0';
+
+		if (sv_eq(key, SV("theme"))) {
+			site->theme_path = value.data;
+		} else if (sv_eq(key, SV("output"))) {
+			site->output_dir = value.data;
+		} else if (sv_eq(key, SV("external-theme"))) {
+			site->stylesheet_dir = value.data;
+		} else if (sv_eq(key, SV("background-color"))) {
+			site->config.background_color = value.data;
+		} else if (sv_eq(key, SV("text-color"))) {
+			site->config.text_color = value.data;
+		} else if (sv_eq(key, SV("accent-color"))) {
+			site->config.accent_color = value.data;
+		} else if (sv_eq(key, SV("minify"))) {
+			site->config.minify = sv_eq(value, SV("true")) || sv_eq(value, SV("yes")) || sv_eq(value, SV("1"));
+		} else if (sv_eq(key, SV("stats"))) {
+			site->print_stats = sv_eq(value, SV("true")) || sv_eq(value, SV("yes")) || sv_eq(value, SV("1"));
+		} else if (sv_eq(key, SV("toc"))) {
+			site->config.toc = sv_eq(value, SV("true")) || sv_eq(value, SV("yes")) || sv_eq(value, SV("1"));
+		} else if (sv_eq(key, SV("base-url"))) {
+			site->config.base_url = trim_slashes((char*)value.data);
+		} else if (sv_eq(key, SV("max-bytes"))) {
+			site->config.max_bytes = atol(value.data);
+		} else if (sv_eq(key, SV("max-commands"))) {
+			site->config.max_commands = atol(value.data);
+		} else if (sv_eq(key, SV("index"))) {
+			site->build_index = sv_eq(value, SV("true")) || sv_eq(value, SV("yes")) || sv_eq(value, SV("1"));
+		} else if (sv_eq(key, SV("to"))) {
+			if (!parse_formats(site, value)) {
+				fprintf(stderr, "%s:%zu: error: unknown output format in: " SV_Fmt "\n", path, line_number, SV_Arg(value));
+				exit(2);
+			}
+		} else if (sv_eq(key, SV("page"))) {
+			Push(*site, pages);
+			*Back(*site, pages) = value.data;
+		} else {
+			fprintf(stderr, "%s:%zu: warning: unrecognized setting: " SV_Fmt "\n", path, line_number, SV_Arg(key));
+		}
+	}
+
+	if (!site->output_dir) {
+		fprintf(stderr, "%s: error: site configuration has no output directory\n", path);
+		exit(2);
+	}
+}
+
+// Paths are appended to base URL and manpath after slash, so their trailing slashes are dropped in place.
+static char const* trim_slashes(char *path)
+{
+	size_t length = strlen(path);
+	while (length > 0 && path[length-1] == '/') {
+		path[--length] = '\0';
+	}
+	return path;
+}
+
+// Loads theme and writes shared stylesheet once, before any page of site is rendered.
+static void prepare_site(Site *site)
+{
+	// Theme is needed only by HTML, of pages or of index
+	bool html = site->build_index && site->output_dir;
+	for (size_t i = 0; i < site->formats_count; ++i) {
+		html = html || site->formats[i] == Msg_Html;
+	}
+	if (html) {
+		load_theme(site);
+	}
+	if (html && site->stylesheet_dir) {
+		write_stylesheet(site);
+	}
+	if ((site->build_index || site->config.base_url) && site->output_dir) {
+		site->index = calloc(site->pages_count, sizeof(*site->index));
+		assert(site->index || site->pages_count == 0);
+	}
+}
+
+// Sets formats of site from comma separated list of their names, like html,markdown.
+// Format given more than once is rendered once.
+static bool parse_formats(Site *site, String_View names)
+{
+	site->formats_count = 0;
+	while (names.count > 0) {
+		Msg_Format format = msg_format_from_name(sv_trim(sv_chop_by_delim(&names, ',')));
+		if (format == Msg_Formats) {
+			return false;
+		}
+		bool seen = false;
+		for (size_t i = 0; i < site->formats_count; ++i) {
+			seen = seen || site->formats[i] == format;
+		}
+		if (!seen) {
+			site->formats[site->formats_count++] = format;
+		}
+	}
+	return site->formats_count > 0;
+}
+
+// Output of page in batch mode is its file name with extension of format appended, like .html,
+// placed in output directory. Parts of paginated page after the first have their number
+// before extension, as links between parts expect. Pages found in manpath keep their directory
+// relative to it, like man1/.
+static void output_path_for(Site const* site, char const* page_path, size_t part, char const* extension, char *buffer, size_t size)
+{
+	String_View directory = page_directory(site, page_path);
+	String_View name = page_name(page_path);
+	if (part > 0) {
+		snprintf(buffer, size, "%s/" SV_Fmt SV_Fmt ".%zu%s", site->output_dir, SV_Arg(directory), SV_Arg(name), part + 1, extension);
+	} else {
+		snprintf(buffer, size, "%s/" SV_Fmt SV_Fmt "%s", site->output_dir, SV_Arg(directory), SV_Arg(name), extension);
+	}
+}
+
+// Configuration of page is configuration of site, except for link to shared stylesheet,
+// which is relative to directory of page. Pages in directories like man1/ go up to output directory first.
+static void page_config(Site const* site, char const* page_path, Msg_Config *config, char *href, size_t size)
+{
+	*config = site->config;
+	String_View directory = page_directory(site, page_path);
+	if (!config->stylesheet_href || directory.count == 0) {
+		return;
+	}
+	size_t count = 0;
+	for (size_t i = 0; i < directory.count; ++i) {
+		if (directory.data[i] == '/' && count + 3 < size) {
+			memcpy(href + count, "../", 3);
+			count += 3;
+		}
+	}
+	snprintf(href + count, size - count, "%s", config->stylesheet_href);
+	config->stylesheet_href = href;
+}
+
+// Directory of page relative to manpath of site with trailing slash, empty for pages given directly.
+static String_View page_directory(Site const* site, char const* path)
+{
+	if (!site->manpath) {
+		return SV("");
+	}
+	size_t prefix = strlen(site->manpath) + 1;
+	char const* name = strrchr(path, '/');
+	if (strlen(path) <= prefix || !name || name + 1 < path + prefix) {
+		return SV("");
+	}
+	return sv_from_parts(path + prefix, name + 1 - (path + prefix));
+}
+
+// Name of page is file name of its source without compression suffix, so ls.1.gz is named ls.1
+static String_View page_name(char const* path)
+{
+	char const* name = strrchr(path, '/');
+	String_View result = sv_from_cstr(name ? name + 1 : path);
+	if (sv_ends_with(result, SV(".gz")) || sv_ends_with(result, SV(".xz"))) {
+		result.count -= 3;
+	}
+	return result;
+}
+
+// Copies everything index needs out of page, since its source is freed after rendering.
+static Index_Entry index_entry_for(Site const* site, Page const* page)
+{
+	String_View fields[] = {
+		page->title[0], page->title[1], page->title[2], page_description(page), page_names(page),
+		page_directory(site, page->path), page_name(page->path), SV(".html"),
+	};
+	size_t size = 0;
+	for (size_t i = 0; i < sizeof(fields) / sizeof(*fields); ++i) {
+		size += fields[i].count;
+	}
+
+	char *buffer = malloc(size), *p = buffer;
+	assert(buffer || size == 0);
+	for (size_t i = 0; i < sizeof(fields) / sizeof(*fields); ++i) {
+		// Missing fields, like description of page without NAME, have no data to copy
+		if (fields[i].count > 0) {
+			memcpy(p, fields[i].data, fields[i].count);
+		}
+		fields[i].data = p;
+		p += fields[i].count;
+	}
+
+	return (Index_Entry) {
+		.name        = fields[0],
+		.section     = fields[1],
+		.date        = fields[2],
+		.description = fields[3],
+		.names       = fields[4],
+		.href        = { .data = fields[5].data, .count = fields[5].count + fields[6].count + fields[7].count },
+	};
+}
+
+static int compare_sv(String_View a, String_View b)
+{
+	int result = memcmp(a.data, b.data, a.count < b.count ? a.count : b.count);
+	return result ? result : (a.count > b.count) - (a.count < b.count);
+}
+
+static int compare_sv_ignorecase(String_View a, String_View b)
+{
+	for (size_t i = 0; i < a.count && i < b.count; ++i) {
+		int x = tolower((unsigned char)a.data[i]), y = tolower((unsigned char)b.data[i]);
+		if (x != y) {
+			return x - y;
+		}
+	}
+	return (a.count > b.count) - (a.count < b.count);
+}
+
+static bool has_prefix_ignorecase(String_View text, String_View prefix)
+{
+	return text.count >= prefix.count && compare_sv_ignorecase(sv_from_parts(text.data, prefix.count), prefix) == 0;
+}
+
+static int compare_index_entries(void const* a, void const* b)
+{
+	Index_Entry const *x = a, *y = b;
+	int result = compare_sv(x->name, y->name);
+	return result ? result : compare_sv(x->section, y->section);
+}
+
+// Writes index.html listing every page of site, sorted by name and section.
+static void write_index(Site const* site, long jobs)
+{
+	if (!site->index) {
+		return;
+	}
+
+	uint64_t start = now_ns();
+	// Slots of pages that failed to build stay empty
+	size_t count = 0;
+	for (size_t i = 0; i < site->pages_count; ++i) {
+		if (site->index[i].href.data) {
+			site->index[count++] = site->index[i];
+		}
+	}
+	parallel_sort(site->index, count, sizeof(*site->index), compare_index_entries, jobs);
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/index.html", site->output_dir);
+
+	if (site->build_index) {
+		Output out = {0};
+		print_index_to(&site->config, site->index, count, &out);
+		write_site_file(site, "index.html", &out);
+		write_whatis(site, count);
+	}
+
+	if (site->config.base_url) {
+		write_sitemap(site, count);
+	}
+
+	if (site->print_stats) {
+		fprintf(stderr, "%s: %zu pages indexed in %.1f ms\n", path, count, (now_ns() - start) / 1e6);
+	}
+}
+
+// Writes out into file of given name in output directory of site and frees it.
+static void write_site_file(Site const* site, char const* name, Output *out)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", site->output_dir, name);
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	write_output(out, fd, path);
+	if (close(fd) != 0) {
+		fprintf(stderr, "error: while trying to write file '%s': %s\n", path, strerror(errno));
+		exit(5);
+	}
+	out_free(out);
+}
+
+// Sitemap and feed come from the same sorted entries as index, so no page is read again.
+// Sitemaps with more URLs than protocol allows are split into sitemap-N.xml files,
+// listed by sitemap.xml.
+static void write_sitemap(Site const* site, size_t count)
+{
+	Output out = {0};
+	if (count <= Msg_Sitemap_Limit) {
+		print_sitemap_to(&site->config, site->index, count, &out);
+		write_site_file(site, "sitemap.xml", &out);
+	} else {
+		size_t sitemaps = (count + Msg_Sitemap_Limit - 1) / Msg_Sitemap_Limit;
+		for (size_t i = 0; i < sitemaps; ++i) {
+			size_t first = i * Msg_Sitemap_Limit;
+			char name[64];
+			snprintf(name, sizeof(name), "sitemap-%zu.xml", i + 1);
+			print_sitemap_to(&site->config, site->index + first, count - first < Msg_Sitemap_Limit ? count - first : Msg_Sitemap_Limit, &out);
+			write_site_file(site, name, &out);
+		}
+		print_sitemap_index_to(&site->config, sitemaps, &out);
+		write_site_file(site, "sitemap.xml", &out);
+	}
+
+	print_feed_to(&site->config, site->index, count, &out);
+	write_site_file(site, "feed.atom", &out);
+}
+
+// Whatis database is written next to index.html from the same entries: header, array of records
+// sorted by name and section ignoring case, and strings they point to. Every name that NAME
+// section lists gets record of its own, pages without any are found by their title.
+// Strings are plain text, without quotes, escapes and markup of page.
+// All numbers are in native byte order, offsets are from start of the file.
+#define Whatis_Magic "MSGWHAT2"
+
+typedef struct whatis_header
+{
+	char magic[8];
+	uint64_t count;
+} Whatis_Header;
+
+typedef struct whatis_string
+{
+	uint32_t offset;
+	uint32_t count;
+} Whatis_String;
+
+typedef struct whatis_record
+{
+	Whatis_String name;
+	Whatis_String section;
+	Whatis_String description;
+	Whatis_String href;
+} Whatis_Record;
+
+// Fields of whatis record before they are written
+typedef struct whatis_entry
+{
+	String_View name;
+	String_View section;
+	String_View description;
+	String_View href;
+} Whatis_Entry;
+
+// Copies text of field as plain text: tags of translated text are dropped, entities and roff escapes
+// like \- become characters again, quotes of .TH arguments are left out and lines are joined.
+// Returns its length.
+static size_t whatis_text(String_View text, char *buffer)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < text.count; ++i) {
+		char c = text.data[i];
+		String_View rest = sv_from_parts(text.data + i, text.count - i);
+		if (c == '<') {
+			char const* close = memchr(rest.data, '>', rest.count);
+			i = close ? (size_t)(close - text.data) : text.count;
+		} else if (c == '&') {
+			static struct { char const* entity; char character; } const entities[] = {
+				{ "&lt;", '<' }, { "&gt;", '>' }, { "&amp;", '&' }, { "&quot;", '"' },
+			};
+			size_t k = 0;
+			while (k < 4 && !sv_starts_with(rest, sv_from_cstr(entities[k].entity))) {
+				++k;
+			}
+			buffer[count++] = k < 4 ? entities[k].character : c;
+			i += k < 4 ? strlen(entities[k].entity) - 1 : 0;
+		} else if (c == '\\') {
+			// Escape that doesn't print, like \&, leaves nothing, other ones their character
+			if (i + 1 < text.count && text.data[i + 1] != '&') {
+				buffer[count++] = text.data[i + 1];
+			}
+			++i;
+		} else if (c != '"') {
+			// Lines of NAME section are joined into one
+			buffer[count++] = c == '\n' ? ' ' : c;
+		}
+	}
+	return count;
+}
+
+static int compare_whatis_entries(void const* a, void const* b)
+{
+	Whatis_Entry const *x = a, *y = b;
+	int result = compare_sv_ignorecase(x->name, y->name);
+	return result ? result : compare_sv_ignorecase(x->section, y->section);
+}
+
+static void write_whatis(Site const* site, size_t count)
+{
+	// Plain text is never longer than text it is made of, so all of it fits into one buffer
+	size_t text_size = 0, entries_count = 0;
+	for (size_t i = 0; i < count; ++i) {
+		Index_Entry const* entry = &site->index[i];
+		text_size += entry->name.count + entry->section.count + entry->description.count + entry->names.count;
+		entries_count += 1;
+		for (size_t j = 0; j < entry->names.count; ++j) {
+			entries_count += entry->names.data[j] == ',';
+		}
+	}
+	char *text = malloc(text_size + 1), *p = text;
+	Whatis_Entry *entries = malloc((entries_count + 1) * sizeof(*entries));
+	assert(text && entries);
+
+	entries_count = 0;
+	for (size_t i = 0; i < count; ++i) {
+		Index_Entry const* entry = &site->index[i];
+		Whatis_Entry whatis = { .href = entry->href };
+		String_View *fields[] = { &whatis.section, &whatis.description };
+		String_View values[] = { entry->section, entry->description };
+		for (size_t j = 0; j < 2; ++j) {
+			*fields[j] = sv_from_parts(p, whatis_text(values[j], p));
+			p += fields[j]->count;
+		}
+
+		String_View names = entry->names;
+		if (names.count == 0) {
+			names = entry->name;
+		}
+		while (names.count > 0) {
+			String_View name = sv_trim(sv_chop_by_delim(&names, ','));
+			size_t length = whatis_text(name, p);
+			whatis.name = sv_trim(sv_from_parts(p, length));
+			p += length;
+			if (whatis.name.count > 0) {
+				entries[entries_count++] = whatis;
+			}
+		}
+	}
+	qsort(entries, entries_count, sizeof(*entries), compare_whatis_entries);
+	// Pages installed under several names, like gzip and gunzip, would be listed once per copy
+	size_t unique = 0;
+	for (size_t i = 0; i < entries_count; ++i) {
+		Whatis_Entry const* last = unique ? &entries[unique - 1] : NULL;
+		if (!last || compare_whatis_entries(last, &entries[i]) != 0 || !sv_eq(last->description, entries[i].description)) {
+			entries[unique++] = entries[i];
+		}
+	}
+	entries_count = unique;
+
+	size_t strings_offset = sizeof(Whatis_Header) + entries_count * sizeof(Whatis_Record);
+	size_t size = strings_offset;
+	for (size_t i = 0; i < entries_count; ++i) {
+		Whatis_Entry const* entry = &entries[i];
+		size += entry->name.count + entry->section.count + entry->description.count + entry->href.count;
+	}
+
+	char *database = calloc(size, 1);
+	assert(database);
+	Whatis_Header *header = (Whatis_Header*)database;
+	memcpy(header->magic, Whatis_Magic, sizeof(header->magic));
+	header->count = entries_count;
+
+	Whatis_Record *records = (Whatis_Record*)(header + 1);
+	size_t offset = strings_offset;
+	for (size_t i = 0; i < entries_count; ++i) {
+		Whatis_Entry const* entry = &entries[i];
+		String_View fields[] = { entry->name, entry->section, entry->description, entry->href };
+		Whatis_String *strings = &records[i].name;
+		for (size_t j = 0; j < 4; ++j) {
+			if (fields[j].count > 0) {
+				memcpy(database + offset, fields[j].data, fields[j].count);
+			}
+			strings[j] = (Whatis_String) { .offset = offset, .count = fields[j].count };
+			offset += fields[j].count;
+		}
+	}
+	free(entries);
+	free(text);
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/whatis.db", site->output_dir);
+	FILE *f = fopen(path, "w");
+	if (!f || fwrite(database, 1, size, f) != size || fclose(f) != 0) {
+		fprintf(stderr, "error: while trying to write file '%s': %s\n", path, strerror(errno));
+		exit(5);
+	}
+	free(database);
+}
+
+// Prints every page with name that starts with term, ignoring case, like whatis(1) does.
+// Database is mapped, not read, and first match is found with binary search.
+static int apropos(char const* database, char const* term)
+{
+	int fd = open(database, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		fprintf(stderr, "error: while trying to open file '%s': %s\n", database, strerror(errno));
+		return 3;
+	}
+
+	char const* data = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	Whatis_Header const* header = (Whatis_Header const*)data;
+	if (data == MAP_FAILED
+		|| st.st_size < sizeof(*header)
+		|| memcmp(header->magic, Whatis_Magic, sizeof(header->magic)) != 0
+		|| header->count > (st.st_size - sizeof(*header)) / sizeof(Whatis_Record)) {
+		fprintf(stderr, "error: '%s' is not whatis database\n", database);
+		return 4;
+	}
+
+	Whatis_Record const* records = (Whatis_Record const*)(header + 1);
+	// Strings are checked only when touched, so lookup doesn't depend on size of database
+	#define Whatis_Sv(string) \
+		((uint64_t)(string).offset + (string).count <= st.st_size \
+			? sv_from_parts(data + (string).offset, (string).count) : SV_NULL)
+
+	String_View prefix = sv_from_cstr(term);
+	size_t low = 0, high = header->count;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (compare_sv_ignorecase(Whatis_Sv(records[middle].name), prefix) < 0) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	size_t found = 0;
+	for (; low < header->count && has_prefix_ignorecase(Whatis_Sv(records[low].name), prefix); ++low, ++found) {
+		Whatis_Record const* record = &records[low];
+		printf(SV_Fmt " (" SV_Fmt ") - " SV_Fmt "\n",
+			SV_Arg(Whatis_Sv(record->name)), SV_Arg(Whatis_Sv(record->section)), SV_Arg(Whatis_Sv(record->description)));
+	}
+	#undef Whatis_Sv
+
+	if (!found) {
+		fprintf(stderr, "%s: nothing appropriate.\n", term);
+		return 1;
+	}
+	return 0;
+}
+
+typedef struct sort_run
+{
+	char *from, *to;
+	size_t size;
+	size_t begin, middle, end;
+	int (*compare)(void const*, void const*);
+} Sort_Run;
+
+static void* sort_run(void *data)
+{
+	Sort_Run *run = data;
+	qsort(run->from + run->begin * run->size, run->end - run->begin, run->size, run->compare);
+	return NULL;
+}
+
+static void* merge_runs(void *data)
+{
+	Sort_Run *run = data;
+	size_t i = run->begin, j = run->middle, k = run->begin;
+	while (i < run->middle && j < run->end) {
+		bool left = run->compare(run->from + i * run->size, run->from + j * run->size) <= 0;
+		memcpy(run->to + k++ * run->size, run->from + (left ? i++ : j++) * run->size, run->size);
+	}
+	memcpy(run->to + k * run->size, run->from + i * run->size, (run->middle - i) * run->size);
+	k += run->middle - i;
+	memcpy(run->to + k * run->size, run->from + j * run->size, (run->end - j) * run->size);
+	return NULL;
+}
+
+// Sorts `jobs` runs of array in parallel, then merges pairs of neighbouring runs
+// in parallel until single run remains. Merge is stable, so result equals qsort's for distinct keys.
+static void parallel_sort(void *base, size_t count, size_t size, int (*compare)(void const*, void const*), long jobs)
+{
+	if (jobs <= 1 || count < 4096) {
+		qsort(base, count, size, compare);
+		return;
+	}
+
+	char *scratch = malloc(count * size);
+	Sort_Run *runs = calloc(jobs, sizeof(*runs));
+	pthread_t *threads = calloc(jobs, sizeof(*threads));
+	assert(scratch && runs && threads);
+
+	size_t runs_count = jobs;
+	size_t *bounds = calloc(runs_count + 1, sizeof(*bounds));
+	assert(bounds);
+	for (size_t i = 0; i <= runs_count; ++i) {
+		bounds[i] = count * i / runs_count;
+	}
+
+	char *from = base, *to = scratch;
+	for (size_t i = 0; i < runs_count; ++i) {
+		runs[i] = (Sort_Run) { .from = from, .size = size, .begin = bounds[i], .end = bounds[i+1], .compare = compare };
+		pthread_create(&threads[i], NULL, sort_run, &runs[i]);
+	}
+	for (size_t i = 0; i < runs_count; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+
+	while (runs_count > 1) {
+		size_t merged = 0;
+		for (size_t i = 0; i < runs_count; i += 2, ++merged) {
+			size_t end = bounds[i + 2 <= runs_count ? i + 2 : i + 1];
+			runs[merged] = (Sort_Run) {
+				.from = from, .to = to, .size = size, .compare = compare,
+				.begin = bounds[i], .middle = bounds[i+1], .end = end,
+			};
+			pthread_create(&threads[merged], NULL, merge_runs, &runs[merged]);
+		}
+		for (size_t i = 0; i < merged; ++i) {
+			pthread_join(threads[i], NULL);
+		}
+		for (size_t i = 0; i < merged; ++i) {
+			bounds[i] = runs[i].begin;
+		}
+		bounds[merged] = count;
+		runs_count = merged;
+
+		char *swap = from;
+		from = to;
+		to = swap;
+	}
+
+	if (from != base) {
+		memcpy(base, from, count * size);
+	}
+	free(bounds);
+	free(threads);
+	free(runs);
+	free(scratch);
+}
+
+// Formats diagnostic as path:line:column: severity: message, leaving out unknown parts of location.
+static int format_diagnostic(Msg_Diagnostic const* diagnostic, char *buffer, size_t size)
+{
+	char location[64] = "";
+	if (diagnostic->line > 0 && diagnostic->column > 0) {
+		snprintf(location, sizeof(location), ":%zu:%zu", diagnostic->line, diagnostic->column);
+	} else if (diagnostic->line > 0) {
+		snprintf(location, sizeof(location), ":%zu", diagnostic->line);
+	}
+	int count = snprintf(buffer, size, "%s%s: %s: " SV_Fmt, diagnostic->path, location,
+		diagnostic->severity == Msg_Error ? "error" : "warning", SV_Arg(diagnostic->message));
+	return count < size ? count : size - 1;
+}
+
+static void print_diagnostic(void *data, Msg_Diagnostic const* diagnostic)
+{
+	char message[1024];
+	format_diagnostic(diagnostic, message, sizeof(message));
+	fprintf(stderr, "%s\n", message);
+}
+
+// Diagnostics of batch build come from all worker threads and are reported once build
+// finishes, sorted by location. Errors only skip page they belong to. Warnings with the same
+// message are reported once, at their first location, with number of occurrences.
+typedef struct reported_diagnostic
+{
+	Msg_Diagnostic diagnostic;
+	size_t count;
+	int status;
+} Reported_Diagnostic;
+
+typedef struct diagnostics
+{
+	pthread_mutex_t lock;
+	Reported_Diagnostic *items;
+	size_t items_count;
+	size_t items_capacity;
+
+	// Index of warning plus one by hash of its message, zero marks empty slot
+	size_t *warnings;
+	size_t warnings_size;
+
+	size_t failed_pages;
+} Diagnostics;
+
+static Diagnostics diagnostics = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int compare_locations(Msg_Diagnostic const* a, Msg_Diagnostic const* b)
+{
+	int order = strcmp(a->path, b->path);
+	if (order != 0) {
+		return order;
+	}
+	if (a->line != b->line) {
+		return a->line < b->line ? -1 : 1;
+	}
+	return a->column < b->column ? -1 : a->column > b->column;
+}
+
+static int compare_reported(void const* a, void const* b)
+{
+	return compare_locations(&((Reported_Diagnostic const*)a)->diagnostic, &((Reported_Diagnostic const*)b)->diagnostic);
+}
+
+static void record_diagnostic(Msg_Diagnostic const* diagnostic, int status)
+{
+	Diagnostics *d = &diagnostics;
+	pthread_mutex_lock(&d->lock);
+
+	size_t *slot = NULL;
+	if (diagnostic->severity == Msg_Warning) {
+		if (2 * d->items_count >= d->warnings_size) {
+			// Rehash, keeping table at most half full
+			free(d->warnings);
+			d->warnings_size = d->warnings_size ? 2 * d->warnings_size : 256;
+			d->warnings = calloc(d->warnings_size, sizeof(*d->warnings));
+			assert(d->warnings);
+			for (size_t i = 0; i < d->items_count; ++i) {
+				Reported_Diagnostic *item = &d->items[i];
+				if (item->diagnostic.severity != Msg_Warning) {
+					continue;
+				}
+				size_t k = fnv1a(item->diagnostic.message) & (d->warnings_size - 1);
+				while (d->warnings[k]) {
+					k = (k + 1) & (d->warnings_size - 1);
+				}
+				d->warnings[k] = i + 1;
+			}
+		}
+
+		size_t k = fnv1a(diagnostic->message) & (d->warnings_size - 1);
+		for (; d->warnings[k]; k = (k + 1) & (d->warnings_size - 1)) {
+			Reported_Diagnostic *item = &d->items[d->warnings[k] - 1];
+			if (sv_eq(item->diagnostic.message, diagnostic->message)) {
+				++item->count;
+				// Keep the earliest location, so report doesn't depend on order of threads
+				if (compare_locations(diagnostic, &item->diagnostic) < 0) {
+					String_View message = item->diagnostic.message;
+					item->diagnostic = *diagnostic;
+					item->diagnostic.message = message;
+				}
+				pthread_mutex_unlock(&d->lock);
+				return;
+			}
+		}
+		slot = &d->warnings[k];
+	}
+
+	char *message = malloc(diagnostic->message.count);
+	assert(message || diagnostic->message.count == 0);
+	memcpy(message, diagnostic->message.data, diagnostic->message.count);
+
+	Push(*d, items);
+	*Back(*d, items) = (Reported_Diagnostic) { .diagnostic = *diagnostic, .count = 1, .status = status };
+	Back(*d, items)->diagnostic.message = sv_from_parts(message, diagnostic->message.count);
+	if (slot) {
+		*slot = d->items_count;
+	}
+	pthread_mutex_unlock(&d->lock);
+}
+
+static void batch_diagnostic(void *data, Msg_Diagnostic const* diagnostic)
+{
+	record_diagnostic(diagnostic, 1);
+}
+
+// Records error that prevented page from being built. Status is exit status of build
+// when it is the first reported error.
+static void batch_failure(char const* path, int status, char const* fmt, ...)
+{
+	__atomic_fetch_add(&diagnostics.failed_pages, 1, __ATOMIC_RELAXED);
+
+	char message[512];
+	va_list args;
+	va_start(args, fmt);
+	int count = vsnprintf(message, sizeof(message), fmt, args);
+	va_end(args);
+
+	record_diagnostic(&(Msg_Diagnostic) {
+		.severity = Msg_Error,
+		.path = path,
+		.message = sv_from_parts(message, count < sizeof(message) ? count : sizeof(message) - 1),
+	}, status);
+}
+
+// Prints all diagnostics of batch build and returns exit status of the build.
+static int report_diagnostics()
+{
+	Diagnostics *d = &diagnostics;
+	if (d->items_count > 0) {
+		qsort(d->items, d->items_count, sizeof(*d->items), compare_reported);
+	}
+
+	int status = 0;
+	size_t errors = 0, warnings = 0;
+	for (size_t i = 0; i < d->items_count; ++i) {
+		Reported_Diagnostic *item = &d->items[i];
+		char message[1024];
+		format_diagnostic(&item->diagnostic, message, sizeof(message));
+		if (item->count > 1) {
+			fprintf(stderr, "%s (%zu times)\n", message, item->count);
+		} else {
+			fprintf(stderr, "%s\n", message);
+		}
+
+		if (item->diagnostic.severity == Msg_Error) {
+			errors += item->count;
+			if (status == 0) {
+				status = item->status;
+			}
+		} else {
+			warnings += item->count;
+		}
+	}
+
+	if (d->failed_pages > 0) {
+		fprintf(stderr, "%zu errors, %zu warnings, %zu pages not built\n", errors, warnings, d->failed_pages);
+	}
+	return status;
+}
+
+static Page read_page(Site const* site, char const* path, String_View src)
+{
+	Page page;
+	if (!parse_page(&site->config, path, src, &page)) {
+		exit(1);
+	}
+	return page;
+}
+
+static void write_output(Output *out, int fd, char const* path)
+{
+	if (fd < 0 || !out_write(out, fd)) {
+		fprintf(stderr, "error: while trying to write file '%s': %s\n", path, strerror(errno));
+		exit(5);
+	}
+}
+
+typedef struct format_job
+{
+	Site const* site;
+	Msg_Config const* config;
+	Page const* page;
+	Msg_Format format;
+	Output *out;
+} Format_Job;
+
+static void* render_format(void *data)
+{
+	Format_Job *job = data;
+	*job->out = (Output) {0};
+	if (job->format == Msg_Html && (job->config->max_bytes || job->config->max_commands)) {
+		write_page_parts(job->site, job->config, job->page, job->out);
+	} else {
+		render_page_as(job->config, job->format, job->page, job->out);
+	}
+	return NULL;
+}
+
+// Renders page of batch build into outs, one for each format of site, all from the same parse.
+// Returns false when page has errors, which were already reported, so caller skips it
+// and its slot of index stays empty. Output refers to text generated while parsing,
+// so caller frees page after writing it.
+static bool render_source(Site const* site, char const* path, String_View src, Index_Entry *entry, Page *result, Output *outs)
+{
+	uint64_t start = site->print_stats ? now_ns() : 0;
+	Page page;
+	if (!parse_page(&site->config, path, src, &page)) {
+		__atomic_fetch_add(&diagnostics.failed_pages, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+	if (entry) {
+		*entry = index_entry_for(site, &page);
+	}
+
+	Msg_Config config;
+	char href[PATH_MAX];
+	page_config(site, path, &config, href, sizeof(href));
+
+	Format_Job jobs[Msg_Formats];
+	pthread_t threads[Msg_Formats];
+	for (size_t i = 0; i < site->formats_count; ++i) {
+		jobs[i] = (Format_Job) { .site = site, .config = &config, .page = &page, .format = site->formats[i], .out = &outs[i] };
+	}
+	// Page is only read by renderers, so formats after the first can be rendered alongside it
+	bool parallel = site->parallel_formats && site->formats_count > 1;
+	for (size_t i = 1; parallel && i < site->formats_count; ++i) {
+		pthread_create(&threads[i], NULL, render_format, &jobs[i]);
+	}
+	for (size_t i = 0; i < site->formats_count; ++i) {
+		if (i == 0 || !parallel) {
+			render_format(&jobs[i]);
+		}
+	}
+	for (size_t i = 1; parallel && i < site->formats_count; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+
+	if (site->print_stats) {
+		size_t saved = 0;
+		for (size_t i = 0; i < site->formats_count; ++i) {
+			saved += outs[i].minify_saved;
+		}
+		__atomic_fetch_add(&throughput.bytes, src.count, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&throughput.ns, now_ns() - start, __ATOMIC_RELAXED);
+		fprintf(stderr, "%s: minification saved %zu bytes\n", page.path, saved);
+	}
+	*result = page;
+	return true;
+}
+
+// Renders first part of paginated page into out, for caller to write it like any other page,
+// and writes remaining parts right away. Only oversized pages have more than one part.
+static void write_page_parts(Site const* site, Msg_Config const* config, Page const* page, Output *out)
+{
+	char name[PATH_MAX];
+	snprintf(name, sizeof(name), SV_Fmt, SV_Arg(page_name(page->path)));
+
+	size_t *breaks;
+	size_t parts_count = paginate_page(config, page, name, &breaks);
+	print_page_part_to(config, page, breaks, parts_count, 0, name, out);
+
+	for (size_t i = 1; i < parts_count; ++i) {
+		char output_path[PATH_MAX];
+		output_path_for(site, page->path, i, ".html", output_path, sizeof(output_path));
+
+		Output part = {0};
+		print_page_part_to(config, page, breaks, parts_count, i, name, &part);
+		int fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		write_output(&part, fd, output_path);
+		if (close(fd) != 0) {
+			fprintf(stderr, "error: while trying to write file '%s': %s\n", output_path, strerror(errno));
+			exit(5);
+		}
+		out->minify_saved += part.minify_saved;
+		out_free(&part);
+	}
+	free(breaks);
+}
+
+static void build_page(Site const* site, char const* path, Index_Entry *entry)
+{
+	char output_path[PATH_MAX];
+
+	String_View src;
+	int status = read_file(path, &src);
+	switch (status) {
+	break; case Read_Open_Failed:
+		batch_failure(path, 3, "while trying to open file: %s", strerror(errno));
+		return;
+	break; case Read_Failed: case Read_Corrupted:
+		batch_failure(path, 4, "while trying to read file: %s", read_error(status));
+		return;
+	}
+
+	Page page;
+	Output outs[Msg_Formats];
+	if (!render_source(site, path, src, entry, &page, outs)) {
+		free((char*)src.data);
+		return;
+	}
+
+	for (size_t i = 0; i < site->formats_count; ++i) {
+		output_path_for(site, path, 0, msg_format_extension(site->formats[i]), output_path, sizeof(output_path));
+		int fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		write_output(&outs[i], fd, output_path);
+		if (close(fd) != 0) {
+			fprintf(stderr, "error: while trying to write file '%s': %s\n", output_path, strerror(errno));
+			exit(5);
+		}
+		out_free(&outs[i]);
+	}
+	free_page(&page);
+	free((char*)src.data);
+}
+
+typedef struct build_pool
+{
+	Sites const* sites;
+	size_t pages_count;
+	size_t next;
+} Build_Pool;
+
+static void* build_worker(void *data)
+{
+	Build_Pool *pool = data;
+	for (;;) {
+		size_t page = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+		if (page >= pool->pages_count) {
+			return NULL;
+		}
+
+		Site const* site = pool->sites->sites;
+		while (page >= site->pages_count) {
+			page -= site->pages_count;
+			++site;
+		}
+		build_page(site, site->pages[page], site->index ? &site->index[page] : NULL);
+	}
+}
+
+// Renders pages of all sites on shared pool of `jobs` threads, taking pages in order
+// of sites, so pool stays busy until last page regardless of how pages are split between sites.
+static void build_sites(Sites const* sites, long jobs)
+{
+	Build_Pool pool = { .sites = sites };
+	for (size_t i = 0; i < sites->sites_count; ++i) {
+		pool.pages_count += sites->sites[i].pages_count;
+	}
+
+	if (jobs == 1) {
+		build_worker(&pool);
+		return;
+	}
+
+	pthread_t *workers = calloc(jobs, sizeof(*workers));
+	assert(workers);
+	for (long i = 0; i < jobs; ++i) {
+		pthread_create(&workers[i], NULL, build_worker, &pool);
+	}
+	for (long i = 0; i < jobs; ++i) {
+		pthread_join(workers[i], NULL);
+	}
+	free(workers);
+}
+
+// Page found while walking manpath, with slot for its index entry
+typedef struct manpath_page
+{
+	char *path;
+	Index_Entry entry;
+} Manpath_Page;
+
+// Walking manpath and rendering pages share one pool of threads. Each thread scans
+// directory when there is one waiting and renders found pages otherwise, so pages
+// of directories scanned first are rendered while the rest of tree is still scanned.
+typedef struct manpath_walk
+{
+	Site const* site;
+	bool index;
+
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+
+	char **directories;
+	size_t directories_count;
+	size_t directories_capacity;
+	size_t scanning;
+
+	Manpath_Page **pages;
+	size_t pages_count;
+	size_t pages_capacity;
+	size_t next;
+} Manpath_Walk;
+
+typedef struct linux_dirent64
+{
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+} Linux_Dirent64;
+
+// Only manN directories of sections 1 to 8 are walked at root of manpath, skipping translations
+static bool is_section_directory(char const* name)
+{
+	return strncmp(name, "man", 3) == 0 && name[3] >= '1' && name[3] <= '8';
+}
+
+// Lists directory with getdents64 in large batches. Found pages and subdirectories
+// are published after every batch, so other threads can start on them right away.
+static void scan_directory(Manpath_Walk *walk, char *directory)
+{
+	Site const* site = walk->site;
+	bool root = strcmp(directory, site->manpath) == 0;
+
+	int fd = openat(AT_FDCWD, directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		batch_failure(directory, 3, "while trying to open directory: %s", strerror(errno));
+		free(directory);
+		return;
+	}
+
+	if (!root) {
+		// Output directory has to exist before any page of directory is written
+		char output[PATH_MAX];
+		snprintf(output, sizeof(output), "%s/%s", site->output_dir, directory + strlen(site->manpath) + 1);
+		if (mkdir(output, 0755) != 0 && errno != EEXIST) {
+			fprintf(stderr, "error: while trying to create directory '%s': %s\n", output, strerror(errno));
+			exit(5);
+		}
+	}
+
+	size_t directory_length = strlen(directory);
+	char buffer[64 * 1024];
+	for (;;) {
+		long size = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+		if (size < 0) {
+			batch_failure(directory, 4, "while trying to read directory: %s", strerror(errno));
+		}
+		if (size <= 0) {
+			break;
+		}
+
+		struct {
+			char **directories;
+			size_t directories_count;
+			size_t directories_capacity;
+
+			Manpath_Page **pages;
+			size_t pages_count;
+			size_t pages_capacity;
+		} found = {0};
+
+		for (long offset = 0; offset < size;) {
+			Linux_Dirent64 *entry = (Linux_Dirent64*)(buffer + offset);
+			offset += entry->d_reclen;
+			char const* name = entry->d_name;
+			if (name[0] == '.' || (root && !is_section_directory(name))) {
+				continue;
+			}
+
+			unsigned char type = entry->d_type;
+			if (type == DT_UNKNOWN || type == DT_LNK) {
+				// Links are followed to pages, but never to directories, so walk can't loop
+				struct stat st;
+				int flags = type == DT_LNK ? 0 : AT_SYMLINK_NOFOLLOW;
+				if (fstatat(fd, name, &st, flags) != 0) {
+					continue;
+				}
+				type = S_ISREG(st.st_mode) ? DT_REG : S_ISDIR(st.st_mode) && type != DT_LNK ? DT_DIR : DT_UNKNOWN;
+			}
+			if (type != DT_REG && type != DT_DIR) {
+				continue;
+			}
+			if (root && type != DT_DIR) {
+				continue;
+			}
+
+			size_t length = directory_length + 1 + strlen(name);
+			char *path = malloc(length + 1);
+			assert(path);
+			snprintf(path, length + 1, "%s/%s", directory, name);
+
+			if (type == DT_DIR) {
+				Push(found, directories);
+				*Back(found, directories) = path;
+			} else {
+				Manpath_Page *page = calloc(1, sizeof(*page));
+				assert(page);
+				page->path = path;
+				Push(found, pages);
+				*Back(found, pages) = page;
+			}
+		}
+
+		pthread_mutex_lock(&walk->lock);
+		for (size_t i = 0; i < found.directories_count; ++i) {
+			Push(*walk, directories);
+			*Back(*walk, directories) = found.directories[i];
+		}
+		for (size_t i = 0; i < found.pages_count; ++i) {
+			Push(*walk, pages);
+			*Back(*walk, pages) = found.pages[i];
+		}
+		pthread_cond_broadcast(&walk->changed);
+		pthread_mutex_unlock(&walk->lock);
+		free(found.directories);
+		free(found.pages);
+	}
+
+	close(fd);
+	free(directory);
+}
+
+static void* manpath_worker(void *data)
+{
+	Manpath_Walk *walk = data;
+	pthread_mutex_lock(&walk->lock);
+	for (;;) {
+		if (walk->directories_count > 0) {
+			char *directory = walk->directories[--walk->directories_count];
+			++walk->scanning;
+			pthread_mutex_unlock(&walk->lock);
+			scan_directory(walk, directory);
+			pthread_mutex_lock(&walk->lock);
+			--walk->scanning;
+			pthread_cond_broadcast(&walk->changed);
+			continue;
+		}
+
+		if (walk->next < walk->pages_count) {
+			Manpath_Page *page = walk->pages[walk->next++];
+			pthread_mutex_unlock(&walk->lock);
+			build_page(walk->site, page->path, walk->index ? &page->entry : NULL);
+			pthread_mutex_lock(&walk->lock);
+			continue;
+		}
+
+		// Nothing is left to do when no directory is being scanned, since only scanning adds work
+		if (walk->scanning == 0) {
+			break;
+		}
+		pthread_cond_wait(&walk->changed, &walk->lock);
+	}
+	pthread_mutex_unlock(&walk->lock);
+	return NULL;
+}
+
+// Renders every page of manN directories of manpath into the same layout in output directory.
+// Afterwards pages of site are the pages found, so index is written as for any other site.
+static void build_manpath(Site *site, long jobs)
+{
+	if (mkdir(site->output_dir, 0755) != 0 && errno != EEXIST) {
+		fprintf(stderr, "error: while trying to create directory '%s': %s\n", site->output_dir, strerror(errno));
+		exit(5);
+	}
+
+	Manpath_Walk walk = {
+		.site = site,
+		.index = site->build_index || site->config.base_url,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.changed = PTHREAD_COND_INITIALIZER,
+	};
+	char *root = strdup(site->manpath);
+	assert(root);
+	Push(walk, directories);
+	*Back(walk, directories) = root;
+
+	pthread_t *workers = calloc(jobs, sizeof(*workers));
+	assert(workers);
+	for (long i = 1; i < jobs; ++i) {
+		pthread_create(&workers[i], NULL, manpath_worker, &walk);
+	}
+	manpath_worker(&walk);
+	for (long i = 1; i < jobs; ++i) {
+		pthread_join(workers[i], NULL);
+	}
+	free(workers);
+	free(walk.directories);
+
+	site->pages_count = site->pages_capacity = walk.pages_count;
+	site->pages = malloc(walk.pages_count * sizeof(*site->pages));
+	free(site->index);
+	site->index = walk.index ? malloc(walk.pages_count * sizeof(*site->index)) : NULL;
+	assert((site->pages && (site->index || !walk.index)) || walk.pages_count == 0);
+	for (size_t i = 0; i < walk.pages_count; ++i) {
+		site->pages[i] = walk.pages[i]->path;
+		if (site->index) {
+			site->index[i] = walk.pages[i]->entry;
+		}
+		free(walk.pages[i]);
+	}
+	free(walk.pages);
+}
+
+// Minimal io_uring interface using raw system calls, so no additional library is needed.
+typedef struct uring
+{
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned sq_entries;
+	unsigned sq_local_tail;
+	unsigned to_submit;
+} Uring;
+
+static bool uring_init(Uring *ring, unsigned entries)
+{
+	struct io_uring_params params = {0};
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0) {
+		return false;
+	}
+
+	size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single_mmap && cq_size > sq_size) {
+		sq_size = cq_size;
+	}
+
+	char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	char *cq = single_mmap ? sq
+		: mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+	if (sq == MAP_FAILED || cq == MAP_FAILED || ring->sqes == MAP_FAILED) {
+		close(ring->fd);
+		return false;
+	}
+
+	ring->sq_head  = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail  = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask  = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+	ring->cq_head  = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail  = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask  = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes     = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	ring->sq_entries = params.sq_entries;
+	ring->sq_local_tail = *ring->sq_tail;
+	ring->to_submit = 0;
+	return true;
+}
+
+static struct io_uring_sqe* uring_sqe(Uring *ring, uint8_t opcode, uint64_t user_data)
+{
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	assert(ring->sq_local_tail - head < ring->sq_entries);
+
+	unsigned index = ring->sq_local_tail++ & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->user_data = user_data;
+	ring->sq_array[index] = index;
+	++ring->to_submit;
+	return sqe;
+}
+
+static void uring_submit_and_wait(Uring *ring)
+{
+	__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+	for (;;) {
+		int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (submitted >= 0) {
+			ring->to_submit -= submitted;
+			return;
+		}
+		if (errno != EINTR) {
+			fprintf(stderr, "error: io_uring_enter failed: %s\n", strerror(errno));
+			exit(6);
+		}
+	}
+}
+
+// Number of pages that are processed at the same time by io_uring backend.
+// Each page has at most two operations in flight (its close and next step).
+#define Uring_Jobs 64
+#define Uring_Close_Tag UINT64_MAX
+
+typedef struct uring_job
+{
+	enum {
+		Job_Open,
+		Job_Stat,
+		Job_Read,
+		Job_Create,
+		Job_Write,
+	} state;
+	char const* path;
+	size_t page;
+	int fd;
+	struct statx stat;
+	char *buffer;
+	size_t size, done;
+	Page parsed;
+	Output out;
+	char output_path[PATH_MAX];
+} Uring_Job;
+
+static void uring_close(Uring *ring, int fd)
+{
+	uring_sqe(ring, IORING_OP_CLOSE, Uring_Close_Tag)->fd = fd;
+}
+
+static void uring_open(Uring *ring, size_t index, char const* path, int flags)
+{
+	struct io_uring_sqe *sqe = uring_sqe(ring, IORING_OP_OPENAT, index);
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)path;
+	sqe->len = 0644;
+	sqe->open_flags = flags;
+}
+
+static void uring_read(Uring *ring, Uring_Job *job, size_t index)
+{
+	struct io_uring_sqe *sqe = uring_sqe(ring, IORING_OP_READ, index);
+	sqe->fd = job->fd;
+	sqe->addr = (uintptr_t)(job->buffer + job->done);
+	sqe->len = job->size - job->done;
+	sqe->off = job->done;
+}
+
+static void uring_writev(Uring *ring, Uring_Job *job, size_t index)
+{
+	size_t remaining = job->out.parts_count - job->out.parts_written;
+	struct io_uring_sqe *sqe = uring_sqe(ring, IORING_OP_WRITEV, index);
+	sqe->fd = job->fd;
+	sqe->addr = (uintptr_t)(job->out.parts + job->out.parts_written);
+	sqe->len = remaining < IOV_MAX ? remaining : IOV_MAX;
+	sqe->off = job->done;
+}
+
+// Keeps up to Uring_Jobs pages in flight: while kernel opens, reads and writes
+// some of them, pages whose source was already read are parsed and rendered.
+// Frees what job holds and starts it on the next page, if there is any left.
+// Returns number of submitted operations.
+static size_t uring_next_page(Uring *ring, Uring_Job *job, size_t index, Site const* site, size_t *next)
+{
+	out_free(&job->out);
+	free_page(&job->parsed);
+	free(job->buffer);
+	if (*next >= site->pages_count) {
+		return 0;
+	}
+	*job = (Uring_Job) { .state = Job_Open, .page = *next, .path = site->pages[*next] };
+	++*next;
+	uring_open(ring, index, job->path, O_RDONLY);
+	return 1;
+}
+
+static bool build_with_uring(Site const* site)
+{
+	char const** paths = site->pages;
+	size_t count = site->pages_count;
+
+	Uring ring;
+	if (!uring_init(&ring, 2 * Uring_Jobs)) {
+		return false;
+	}
+
+	Uring_Job jobs[Uring_Jobs];
+	size_t next = 0, in_flight = 0;
+
+	for (size_t i = 0; i < Uring_Jobs && next < count; ++i, ++in_flight) {
+		jobs[i] = (Uring_Job) { .state = Job_Open, .page = next, .path = paths[next] };
+		++next;
+		uring_open(&ring, i, jobs[i].path, O_RDONLY);
+	}
+
+	while (in_flight > 0) {
+		uring_submit_and_wait(&ring);
+
+		unsigned head = *ring.cq_head;
+		while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe cqe = ring.cqes[head++ & *ring.cq_mask];
+			__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+			--in_flight;
+
+			if (cqe.user_data == Uring_Close_Tag) {
+				continue;
+			}
+
+			size_t index = cqe.user_data;
+			Uring_Job *job = &jobs[index];
+
+			if (cqe.res < 0 && job->state >= Job_Create) {
+				fprintf(stderr, "error: while trying to write file '%s': %s\n", job->output_path, strerror(-cqe.res));
+				exit(5);
+			}
+
+			if (cqe.res < 0) {
+				// Page that can't be read is skipped, reported after build
+				bool opened = job->state != Job_Open;
+				batch_failure(job->path, opened ? 4 : 3, "while trying to %s file: %s", opened ? "read" : "open", strerror(-cqe.res));
+				if (opened) {
+					uring_close(&ring, job->fd);
+					++in_flight;
+				}
+				in_flight += uring_next_page(&ring, job, index, site, &next);
+				continue;
+			}
+
+			switch (job->state) {
+			break; case Job_Open: {
+				job->fd = cqe.res;
+				job->state = Job_Stat;
+				struct io_uring_sqe *sqe = uring_sqe(&ring, IORING_OP_STATX, index);
+				sqe->fd = job->fd;
+				sqe->addr = (uintptr_t)"";
+				sqe->len = STATX_SIZE;
+				sqe->off = (uintptr_t)&job->stat;
+				sqe->statx_flags = AT_EMPTY_PATH;
+				++in_flight;
+				continue;
+			}
+
+			break; case Job_Stat:
+				job->size = job->stat.stx_size;
+				job->done = 0;
+				job->buffer = calloc(job->size + 1, 1);
+				assert(job->buffer);
+				job->state = Job_Read;
+				if (job->size > 0) {
+					uring_read(&ring, job, index);
+					++in_flight;
+					continue;
+				}
+
+			break; case Job_Read:
+				job->done += cqe.res;
+				if (cqe.res > 0 && job->done < job->size) {
+					uring_read(&ring, job, index);
+					++in_flight;
+					continue;
+				}
+				String_View src = sv_from_parts(job->buffer, job->size);
+				if (job->done < job->size || !decompress(&src)) {
+					batch_failure(job->path, 4, "while trying to read file: %s",
+						job->done < job->size ? "unexpected end of file" : read_error(Read_Corrupted));
+					uring_close(&ring, job->fd);
+					++in_flight;
+					in_flight += uring_next_page(&ring, job, index, site, &next);
+					continue;
+				}
+				job->buffer = (char*)src.data;
+				job->size = src.count;
+
+			break; case Job_Create:
+				job->fd = cqe.res;
+				job->state = Job_Write;
+				job->done = 0;
+				if (job->out.bytes > 0) {
+					uring_writev(&ring, job, index);
+					++in_flight;
+					continue;
+				}
+
+			break; case Job_Write:
+				job->done += cqe.res;
+				out_advance(&job->out, cqe.res);
+				if (job->out.parts_written < job->out.parts_count) {
+					uring_writev(&ring, job, index);
+					++in_flight;
+					continue;
+				}
+			}
+
+			uring_close(&ring, job->fd);
+			++in_flight;
+
+			if (job->state == Job_Read && render_source(site, job->path, (String_View) { .data = job->buffer, .count = job->size },
+					site->index ? &site->index[job->page] : NULL, &job->parsed, &job->out)) {
+				job->state = Job_Create;
+				output_path_for(site, job->path, 0, msg_format_extension(site->formats[0]), job->output_path, sizeof(job->output_path));
+				uring_open(&ring, index, job->output_path, O_WRONLY | O_CREAT | O_TRUNC);
+				++in_flight;
+				continue;
+			}
+
+			in_flight += uring_next_page(&ring, job, index, site, &next);
+		}
+	}
+
+	close(ring.fd);
+	return true;
+}
+
+// Daemon protocol, one request after another on single connection:
+//   PATH <path>\n               renders file read by daemon
+//   SOURCE <size> [<name>]\n    followed by <size> bytes of page source
+// Each request is answered with
+//   OK <size>\n                 followed by <size> bytes of HTML
+//   ERROR <size>\n              followed by <size> bytes of error messages
+typedef struct connection
+{
+	int fd;
+	char buffer[4096];
+	size_t start, end;
+} Connection;
+
+static bool connection_fill(Connection *conn)
+{
+	if (conn->start == conn->end) {
+		conn->start = conn->end = 0;
+	}
+	for (;;) {
+		ssize_t n = read(conn->fd, conn->buffer + conn->end, sizeof(conn->buffer) - conn->end);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		conn->end += n;
+		return true;
+	}
+}
+
+static bool connection_read_line(Connection *conn, char *line, size_t size)
+{
+	for (size_t count = 0;;) {
+		while (conn->start < conn->end) {
+			char c = conn->buffer[conn->start++];
+			if (c == '\n') {
+				line[count] = '\0';
+				return true;
+			}
+			if (count + 1 == size) {
+				return false;
+			}
+			line[count++] = c;
+		}
+		if (!connection_fill(conn)) {
+			return false;
+		}
+	}
+}
+
+static bool connection_read(Connection *conn, char *data, size_t size)
+{
+	while (size > 0) {
+		if (conn->start == conn->end && !connection_fill(conn)) {
+			return false;
+		}
+		size_t n = conn->end - conn->start < size ? conn->end - conn->start : size;
+		memcpy(data, conn->buffer + conn->start, n);
+		conn->start += n;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool write_all(int fd, char const* data, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = write(fd, data, size);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+static void collect_diagnostic(void *data, Msg_Diagnostic const* diagnostic)
+{
+	Msg_Buffer *errors = data;
+	char line[1024];
+	int count = format_diagnostic(diagnostic, line, sizeof(line) - 1);
+	line[count++] = '\n';
+	Output out = { .buffer = errors };
+	out_sv(&out, sv_from_parts(line, count));
+}
 
-typedef struct command
+// Handles requests on single connection until client closes it.
+static void serve_connection(Site const* site, int fd)
 {
-	enum {
-		Text,
-		Link,
-	} type;
-	String_View value;
-} Command;
+	Connection conn = { .fd = fd };
+	char line[PATH_MAX + 64];
+
+	while (connection_read_line(&conn, line, sizeof(line))) {
+		Msg_Buffer errors = {0};
+		Msg_Config request_config = site->config;
+		request_config.diagnostic = collect_diagnostic;
+		request_config.diagnostic_data = &errors;
+
+		String_View src = SV_NULL;
+		char const* path = NULL;
+		if (strncmp(line, "PATH ", 5) == 0) {
+			path = line + 5;
+			int status = read_file(path, &src);
+			if (status != Read_Ok) {
+				collect_diagnostic(&errors, &(Msg_Diagnostic) {
+					.severity = Msg_Error, .path = path, .message = sv_from_cstr(read_error(status)),
+				});
+				src = SV_NULL;
+			}
+		} else if (strncmp(line, "SOURCE ", 7) == 0) {
+			char *name;
+			size_t size = strtoull(line + 7, &name, 10);
+			path = *name == ' ' ? name + 1 : "-";
+			char *buffer = malloc(size + 1);
+			if (!buffer || !connection_read(&conn, buffer, size)) {
+				free(buffer);
+				break;
+			}
+			buffer[size] = '\0';
+			src = sv_from_parts(buffer, size);
+			if (!decompress(&src)) {
+				collect_diagnostic(&errors, &(Msg_Diagnostic) {
+					.severity = Msg_Error, .path = path, .message = sv_from_cstr(read_error(Read_Corrupted)),
+				});
+				free(buffer);
+				src = SV_NULL;
+			}
+		} else {
+			collect_diagnostic(&errors, &(Msg_Diagnostic) {
+				.severity = Msg_Error, .path = "-", .message = SV("unknown request"),
+			});
+		}
+
+		Page page;
+		Output out = {0};
+		bool ok = src.data && parse_page(&request_config, path, src, &page);
+		if (ok) {
+			ok = print_page_to(&request_config, &page, &out);
+			if (!ok) {
+				free_page(&page);
+			}
+		}
+
+		char header[64];
+		int header_size = snprintf(header, sizeof(header), "%s %zu\n",
+			ok ? "OK" : "ERROR", ok ? out.bytes : errors.count);
+		bool sent = write_all(fd, header, header_size)
+			&& (ok ? out_write(&out, fd) : write_all(fd, errors.data, errors.count));
+		if (ok && errors.count) {
+			// Warnings don't fail request, daemon keeps them in its log
+			fwrite(errors.data, 1, errors.count, stderr);
+		}
+
+		out_free(&out);
+		if (ok) {
+			free_page(&page);
+		}
+		free(errors.data);
+		free((char*)src.data);
+		if (!sent) {
+			break;
+		}
+	}
+
+	close(fd);
+}
 
-typedef struct section
+typedef struct server
 {
-	String_View name;
+	Site const* site;
+	int listener;
+} Server;
+
+static void* serve_worker(void *data)
+{
+	Server const* server = data;
+	for (;;) {
+		int fd = accept(server->listener, NULL, NULL);
+		if (fd < 0) {
+			if (errno != EINTR && errno != ECONNABORTED) {
+				fprintf(stderr, "error: while accepting connection: %s\n", strerror(errno));
+			}
+			continue;
+		}
+		serve_connection(server->site, fd);
+	}
+	return NULL;
+}
+
+// Keeps theme and configuration loaded and renders pages for clients.
+// Each of `jobs` workers accepts connections on shared socket and serves one at the time.
+static void serve(Site const* site, char const* socket_path, long jobs)
+{
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "error: socket path is too long: %s\n", socket_path);
+		exit(2);
+	}
+	strcpy(address.sun_path, socket_path);
+
+	Server server = { .site = site, .listener = socket(AF_UNIX, SOCK_STREAM, 0) };
+	unlink(socket_path);
+	if (server.listener < 0
+		|| bind(server.listener, (struct sockaddr*)&address, sizeof(address)) != 0
+		|| listen(server.listener, SOMAXCONN) != 0) {
+		fprintf(stderr, "error: while trying to listen on '%s': %s\n", socket_path, strerror(errno));
+		exit(6);
+	}
 
-	Command *commands;
-	size_t commands_count;
-	size_t commands_capacity;
-} Section;
+	signal(SIGPIPE, SIG_IGN);
 
-#define Title_Fields 5
+	pthread_t *workers = calloc(jobs, sizeof(*workers));
+	assert(workers);
+	for (long i = 0; i < jobs; ++i) {
+		pthread_create(&workers[i], NULL, serve_worker, &server);
+	}
+	for (long i = 0; i < jobs; ++i) {
+		pthread_join(workers[i], NULL);
+	}
+}
 
-typedef struct page
+typedef struct load_test_client
 {
-	char const* path;
-	String_View title[Title_Fields];
+	char const* socket_path;
+	String_View src;
+	size_t requests;
+	uint64_t *latencies;
+	size_t failed;
+} Load_Test_Client;
 
-	Section *sections;
-	size_t sections_count;
-	size_t sections_capacity;
-} Page;
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Speed is measured per thread, so it can be compared to target from README regardless of -j
+static void print_throughput(char const* path)
+{
+	if (throughput.ns > 0) {
+		fprintf(stderr, "%s: %.1f MB of roff converted at %.1f MB/s per thread\n",
+			path, throughput.bytes / 1e6, throughput.bytes * 1e3 / throughput.ns);
+	}
+}
 
+static void* load_test_worker(void *data)
+{
+	Load_Test_Client *client = data;
 
-static Page parse_page(char const* path);
-static String_View read_entire_file(char const* filename);
-static void ensure_enough_space(void **mem, size_t element_size, size_t desired_count, size_t *capacity);
-static void print_page_to(Page const* page, FILE *out);
-static void print_link_to(String_View link, FILE *out);
-static void summary(Page const* page);
-static void usage();
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	strncpy(address.sun_path, client->socket_path, sizeof(address.sun_path) - 1);
+	Connection conn = { .fd = socket(AF_UNIX, SOCK_STREAM, 0) };
+	if (conn.fd < 0 || connect(conn.fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+		fprintf(stderr, "error: while trying to connect to '%s': %s\n", client->socket_path, strerror(errno));
+		exit(6);
+	}
 
-#define Push(array, field) \
-		ensure_enough_space((void**)&(array).field, sizeof((array).field[0]), ++((array).field##_count), &(array).field##_capacity);
+	char header[64];
+	int header_size = snprintf(header, sizeof(header), "SOURCE %zu load-test\n", client->src.count);
+	char *response = NULL;
+	size_t response_capacity = 0;
 
-#define Back(array, field) \
-	(&((array).field[(array).field##_count-1]))
+	for (size_t i = 0; i < client->requests; ++i) {
+		uint64_t start = now_ns();
+		char line[64];
+		if (!write_all(conn.fd, header, header_size)
+			|| !write_all(conn.fd, client->src.data, client->src.count)
+			|| !connection_read_line(&conn, line, sizeof(line))) {
+			fprintf(stderr, "error: connection to daemon closed\n");
+			exit(6);
+		}
 
-int main(int argc, char **argv)
+		size_t size = strtoull(strchr(line, ' ') ? strchr(line, ' ') + 1 : line, NULL, 10);
+		if (size > response_capacity) {
+			response = realloc(response, response_capacity = size);
+			assert(response);
+		}
+		connection_read(&conn, response, size);
+		client->failed += strncmp(line, "OK ", 3) != 0;
+		client->latencies[i] = now_ns() - start;
+	}
+
+	free(response);
+	close(conn.fd);
+	return NULL;
+}
+
+static int compare_u64(void const* a, void const* b)
 {
-	program_name = *argv;
-	assert(program_name);
+	uint64_t x = *(uint64_t const*)a, y = *(uint64_t const*)b;
+	return (x > y) - (x < y);
+}
 
-	bool print_summary = false;
-	for (int i = 1; --argc; ++i) {
-		if (argv[i][0] == '-') {
-			if (strcmp("-h", argv[i]) == 0) {
-				usage();
-			}
-			if (strcmp("-s", argv[i]) == 0) {
-				print_summary = true;
+// Sends page to daemon `requests` times from `jobs` concurrent connections
+// and reports latency percentiles of whole request, including transfer of result.
+static void load_test(char const* socket_path, char const* page_path, size_t requests, long jobs)
+{
+	String_View src = read_entire_file(page_path);
+	uint64_t *latencies = calloc(requests, sizeof(*latencies));
+	Load_Test_Client *clients = calloc(jobs, sizeof(*clients));
+	pthread_t *threads = calloc(jobs, sizeof(*threads));
+	assert(latencies && clients && threads);
+
+	uint64_t start = now_ns();
+	for (long i = 0, offset = 0; i < jobs; ++i) {
+		size_t count = requests / jobs + (i < requests % jobs);
+		clients[i] = (Load_Test_Client) {
+			.socket_path = socket_path,
+			.src = src,
+			.requests = count,
+			.latencies = latencies + offset,
+		};
+		offset += count;
+		pthread_create(&threads[i], NULL, load_test_worker, &clients[i]);
+	}
+
+	size_t failed = 0;
+	for (long i = 0; i < jobs; ++i) {
+		pthread_join(threads[i], NULL);
+		failed += clients[i].failed;
+	}
+	uint64_t elapsed = now_ns() - start;
+
+	qsort(latencies, requests, sizeof(*latencies), compare_u64);
+	printf("requests: %zu (%zu failed) from %ld connections in %.3f s, %.0f requests/s\n",
+		requests, failed, jobs, elapsed / 1e9, requests / (elapsed / 1e9));
+	printf("latency: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+		latencies[requests / 2] / 1e3, latencies[requests * 99 / 100] / 1e3, latencies[requests - 1] / 1e3);
+}
+
+// Buffered writer for output that is produced piece by piece, like summary.
+// Memory use doesn't depend on amount of written data.
+typedef struct writer
+{
+	int fd;
+	char const* path;
+	size_t count;
+	char data[64 * 1024];
+} Writer;
+
+static void writer_write_all(Writer *w, void const* data, size_t count)
+{
+	if (!write_all(w->fd, data, count)) {
+		fprintf(stderr, "error: while trying to write file '%s': %s\n", w->path, strerror(errno));
+		exit(5);
+	}
+}
+
+static void writer_flush(Writer *w)
+{
+	writer_write_all(w, w->data, w->count);
+	w->count = 0;
+}
+
+static void writer_write(Writer *w, void const* data, size_t count)
+{
+	if (w->count + count > sizeof(w->data)) {
+		writer_flush(w);
+		if (count > sizeof(w->data)) {
+			// Pieces larger than buffer are written directly
+			writer_write_all(w, data, count);
+			return;
+		}
+	}
+	memcpy(w->data + w->count, data, count);
+	w->count += count;
+}
+
+static void writer_sv(Writer *w, String_View sv)
+{
+	writer_write(w, sv.data, sv.count);
+}
+
+static void writer_cstr(Writer *w, char const* cstr)
+{
+	writer_write(w, cstr, strlen(cstr));
+}
+
+// Writes string as JSON string literal. Bytes that aren't valid UTF-8 are
+// replaced with U+FFFD, so document is well formed for any source.
+static void writer_json_string(Writer *w, String_View sv)
+{
+	writer_cstr(w, "\"");
+	size_t start = 0;
+	for (size_t i = 0; i < sv.count;) {
+		unsigned char c = sv.data[i];
+		if (c >= 0x80) {
+			size_t length = msg_utf8_length(sv, i);
+			if (length > 0) {
+				i += length;
 				continue;
 			}
-			fprintf(stderr, "error: unrecognized parameter: %s\n", argv[i]);
-			return 2;
+		} else if (c >= 0x20 && c != '"' && c != '\\') {
+			++i;
+			continue;
 		}
 
-		manpage_path = argv[i];
-		break;
+		writer_write(w, sv.data + start, i - start);
+		char escape[8];
+		switch (c) {
+		break; case '"':  writer_cstr(w, "\\\"");
+		break; case '\\': writer_cstr(w, "\\\\");
+		break; case '\n': writer_cstr(w, "\\n");
+		break; case '\t': writer_cstr(w, "\\t");
+		break; case '\r': writer_cstr(w, "\\r");
+		break; default:
+			if (c >= 0x80) {
+				writer_cstr(w, "\\ufffd");
+			} else {
+				snprintf(escape, sizeof(escape), "\\u%04x", c);
+				writer_cstr(w, escape);
+			}
+		}
+		start = ++i;
 	}
+	writer_write(w, sv.data + start, sv.count - start);
+	writer_cstr(w, "\"");
+}
 
-	Page page = parse_page(manpage_path);
+// Binary summary is sequence of records: kind and length of value, followed by value.
+// First come title fields in order, then every section followed by its commands,
+// last record has kind Summary_End. All numbers are in native byte order.
+#define Summary_Magic "MSGSUMM1"
 
-	if (print_summary) {
-		summary(&page);
-	} else {
-		print_page_to(&page, stdout);
-	}
+enum {
+	Summary_Title,
+	Summary_Section,
+	Summary_Text_Command,
+	Summary_Link_Command,
+	Summary_End,
+	// Commands of macros follow in order of their types, starting with Subsection
+	Summary_Macro_Command,
+};
 
-	return 0;
+static char const* const command_names[Command_Types] = {
+	[Text]               = "text",
+	[Link]               = "link",
+	[Subsection]         = "subsection",
+	[Paragraph]          = "paragraph",
+	[Tagged_Paragraph]   = "tagged-paragraph",
+	[Indented_Paragraph] = "indented-paragraph",
+	[Hanging_Paragraph]  = "hanging-paragraph",
+	[Indent]             = "indent",
+	[Unindent]           = "unindent",
+	[Bold]               = "bold",
+	[Italic]             = "italic",
+	[Bold_Roman]         = "bold-roman",
+	[Italic_Roman]       = "italic-roman",
+	[Roman_Bold]         = "roman-bold",
+	[Roman_Italic]       = "roman-italic",
+	[Bold_Italic]        = "bold-italic",
+	[Italic_Bold]        = "italic-bold",
+	[No_Fill]            = "no-fill",
+	[Fill]               = "fill",
+	[Name]               = "name",
+	[Description]        = "description",
+	[Inline]             = "inline",
+	[List_Begin]         = "list-begin",
+	[List_End]           = "list-end",
+	[List_Item]          = "list-item",
+	[Preformatted]       = "preformatted",
+	[Include]            = "include",
+};
+
+typedef struct summary_record
+{
+	uint32_t kind;
+	uint32_t count;
+} Summary_Record;
+
+static void writer_record(Writer *w, uint32_t kind, String_View value)
+{
+	Summary_Record record = { .kind = kind, .count = value.count };
+	writer_write(w, &record, sizeof(record));
+	writer_sv(w, value);
 }
 
-static Page parse_page(char const* path)
+static void summary(Page const* page, Summary_Format format)
 {
-	String_View src = read_entire_file(path);
-	Page page = {
-		.path = path
+	Writer w = { .fd = STDOUT_FILENO, .path = "-" };
+
+	char const *title_names[] = {
+		"title", "section", "date", "source", "manual-section"
 	};
 
-	while (src.count != 0) {
-		String_View line = sv_chop_by_delim(&src, '\n');
-
-		if (sv_starts_with(line, SV(".TH"))) {
-			bool escape = false;
-			int cursor = 0, start = 0;
-
-			sv_chop_left(&line, 3);
-			line = sv_trim_left(line);
-			for (int i = start; i < line.count && cursor < Title_Fields; ++i) {
-				if ((!escape && line.data[i] == ' ') || i+1 == line.count) {
-					page.title[cursor++] = sv_trim((String_View) {
-						.data  = line.data + start,
-						.count = i - start + 1,
-					});
-					start = i;
-					continue;
-				}
-				if (line.data[i] == '\\') {
-					escape = true;
-					continue;
-				}
-				escape = false;
-			}
-			continue;
+	switch (format) {
+	break; case Summary_Text:
+		for (int i = 0; i < Title_Fields; ++i) {
+			writer_cstr(&w, title_names[i]); writer_cstr(&w, ": "); writer_sv(&w, page->title[i]); writer_cstr(&w, "\n");
 		}
 
-		if (sv_starts_with(line, SV(".SH"))) {
-			sv_chop_left(&line, 3);
-			line = sv_trim_left(line);
-			Push(page, sections);
-			Back(page, sections)->name = line;
-			continue;
+		for (int i = 0; i < page->sections_count; ++i) {
+			writer_cstr(&w, "SECTION "); writer_sv(&w, page->sections[i].name); writer_cstr(&w, "\n");
+
+			for (int j = 0; j < page->sections[i].commands_count; ++j) {
+				Command *c = &page->sections[i].commands[j];
+				char type[32];
+				writer_write(&w, type, snprintf(type, sizeof(type), "  COMMAND(%d) ", c->type));
+				writer_sv(&w, c->value); writer_cstr(&w, "\n");
+			}
 		}
 
-		if (sv_starts_with(line, SV(".LN"))) {
-			sv_chop_left(&line, 3);
-			Section *last = Back(page, sections);
-			Push(*last, commands);
-			*Back(*last, commands) = (Command) { .type = Link, .value = line };
-			continue;
+	break; case Summary_Json:
+		writer_cstr(&w, "{\"title\":{");
+		for (int i = 0; i < Title_Fields; ++i) {
+			writer_cstr(&w, i ? ",\"" : "\""); writer_cstr(&w, title_names[i]); writer_cstr(&w, "\":");
+			writer_json_string(&w, page->title[i]);
 		}
+		writer_cstr(&w, "},\"sections\":[");
 
-		if (sv_starts_with(line, SV("."))) {
-			fprintf(stderr, "%s: warning: unrecognized command: " SV_Fmt "\n", page.path, SV_Arg(line));
-			continue;
+		for (int i = 0; i < page->sections_count; ++i) {
+			writer_cstr(&w, i ? ",\n{\"name\":" : "\n{\"name\":");
+			writer_json_string(&w, page->sections[i].name);
+			writer_cstr(&w, ",\"commands\":[");
+
+			for (int j = 0; j < page->sections[i].commands_count; ++j) {
+				Command *c = &page->sections[i].commands[j];
+				writer_cstr(&w, j ? ",\n{\"type\":\"" : "\n{\"type\":\"");
+				writer_cstr(&w, command_names[c->type]);
+				writer_cstr(&w, "\",\"value\":");
+				writer_json_string(&w, c->value);
+				writer_cstr(&w, "}");
+			}
+			writer_cstr(&w, "]}");
 		}
+		writer_cstr(&w, "]}\n");
 
-		if (page.sections_count == 0) {
-			fprintf(stderr, "%s: error: trying to add text without specifing section header .SH\n", page.path);
-			exit(1);
+	break; case Summary_Binary:
+		writer_cstr(&w, Summary_Magic);
+		for (int i = 0; i < Title_Fields; ++i) {
+			writer_record(&w, Summary_Title, page->title[i]);
 		}
 
-		Section *last = Back(page, sections);
-		Push(*last, commands);
-		*Back(*last, commands) = (Command) { .type = Text, .value = line };
+		for (int i = 0; i < page->sections_count; ++i) {
+			writer_record(&w, Summary_Section, page->sections[i].name);
+
+			for (int j = 0; j < page->sections[i].commands_count; ++j) {
+				Command *c = &page->sections[i].commands[j];
+				uint32_t kind = c->type == Text ? Summary_Text_Command
+					: c->type == Link ? Summary_Link_Command
+					: Summary_Macro_Command + c->type - Subsection;
+				writer_record(&w, kind, c->value);
+			}
+		}
+		writer_record(&w, Summary_End, SV_NULL);
 	}
 
-	return page;
+	writer_flush(&w);
 }
 
-static void print_page_to(Page const* page, FILE *out)
-{
-	fprintf(out,
-		"<!DOCTYPE html>\n"
-		"<html>\n"
-		"<head>\n"
-		"<meta charset=\"utf-8\" />\n");
-	fprintf(out, "<title>" SV_Fmt "</title>\n", SV_Arg(page->title[4])); // TODO add escaping resolution
-	fprintf(out, "<style>\n");
-	fprintf(out, ":root { --background-color: %sdeg; --text-color: %sdeg; --accent-color: %sdeg; }",
-		background_color, text_color, accent_color);
-	fprintf(out, "</style>\n");
-	fprintf(out, "<style>" SV_Fmt "</style>\n", SV_Arg(read_entire_file(theme)));
-	fprintf(out, "</head>\n");
-
-	fprintf(out, "<body>\n");
-	fprintf(out, "<div class=\"content\">\n");
-
-	fprintf(out, "<header>\n");
-	fprintf(out, "<div>" SV_Fmt "(" SV_Fmt ")</div>\n", SV_Arg(page->title[0]), SV_Arg(page->title[1]));
-	fprintf(out, "<div><h1>" SV_Fmt "</h1></div>\n", SV_Arg(page->title[4]));
-	fprintf(out, "<div>" SV_Fmt "(" SV_Fmt ")</div>\n", SV_Arg(page->title[0]), SV_Arg(page->title[1]));
-	fprintf(out, "</header>\n");
-
-	for (int i = 0; i < page->sections_count; ++i) {
-		Section const* section = &page->sections[i];
-		fprintf(out, "<section>\n");
-		fprintf(out, "<h2>" SV_Fmt "</h2>", SV_Arg(section->name));
-
-		for (int j = 0; j < section->commands_count; ++j) {
-			Command const* command = &section->commands[j];
-			switch (command->type) {
-			break; case Text:
-				if (sv_trim(command->value).count == 0) {
-					fprintf(out, "<br /><br />\n");
-				} else {
-					fprintf(out, SV_Fmt "\n", SV_Arg(command->value));
-				}
-			break; case Link: print_link_to(command->value, out);
+// Writes path with . and .. resolved, without looking at file system, since directories
+// of build may not exist yet. Relative paths are taken from current directory.
+static void absolute_path(char const* path, char *buffer, size_t size)
+{
+	char joined[PATH_MAX * 2];
+	if (path[0] == '/' || !getcwd(joined, PATH_MAX)) {
+		snprintf(joined, sizeof(joined), "%s", path);
+	} else {
+		size_t length = strlen(joined);
+		snprintf(joined + length, sizeof(joined) - length, "/%s", path);
+	}
+
+	size_t count = 0;
+	String_View rest = sv_from_cstr(joined);
+	while (rest.count > 0) {
+		String_View component = sv_chop_by_delim(&rest, '/');
+		if (component.count == 0 || sv_eq(component, SV("."))) {
+			continue;
+		}
+		if (sv_eq(component, SV(".."))) {
+			while (count > 0 && buffer[--count] != '/') {
 			}
+			continue;
 		}
-
-		fprintf(out, "</section>\n");
+		if (count + component.count + 2 > size) {
+			break;
+		}
+		buffer[count++] = '/';
+		memcpy(buffer + count, component.data, component.count);
+		count += component.count;
 	}
+	buffer[count] = '\0';
+}
 
-	fprintf(out, "<footer>\n");
-	fprintf(out, "<div>" SV_Fmt "</div>\n", SV_Arg(page->title[3]));
-	fprintf(out, "<div>" SV_Fmt "</div>\n", SV_Arg(page->title[2]));
-	fprintf(out, "<div>" SV_Fmt "</div>\n", SV_Arg(page->title[3]));
-	fprintf(out, "</footer>\n");
+// Writes path that leads from absolute directory from to absolute directory to,
+// with trailing slash unless it is empty. Returns its length.
+static size_t relative_path(char const* from, char const* to, char *buffer, size_t size)
+{
+	// Longest common prefix that ends at boundary of component in both paths
+	size_t common = 0;
+	for (size_t i = 0;; ++i) {
+		if ((from[i] == '/' || from[i] == '\0') && (to[i] == '/' || to[i] == '\0')) {
+			common = i;
+		}
+		if (from[i] != to[i] || from[i] == '\0') {
+			break;
+		}
+	}
 
-	fprintf(out, "</div>\n");
-	fprintf(out, "</body>\n");
-	fprintf(out, "</html>\n");
+	size_t count = 0;
+	for (char const* p = from + common; *p; ++p) {
+		if (*p == '/' && count + 3 < size) {
+			memcpy(buffer + count, "../", 3);
+			count += 3;
+		}
+	}
+	if (to[common] != '\0') {
+		count += snprintf(buffer + count, size - count, "%s/", to + common + 1);
+	}
+	count = count < size ? count : size - 1;
+	buffer[count] = '\0';
+	return count;
 }
 
-static void print_link_to(String_View src, FILE *out)
+// Writes color variables and theme as single stylesheet named after hash of its content,
+// so it can be served with long lived caching and is only written when it changes.
+static void write_stylesheet(Site *site)
 {
-	src = sv_trim(src);
-	String_View href = sv_trim(sv_chop_by_delim(&src, ' '));
-	src = sv_trim(src);
+	Msg_Buffer stylesheet = {0};
+	if (!render_stylesheet(&site->config, &stylesheet)) {
+		fprintf(stderr, "error: out of memory while rendering stylesheet\n");
+		exit(5);
+	}
+
+	char name[64];
+	snprintf(name, sizeof(name), "theme.%016" PRIx64 ".css",
+		fnv1a((String_View) { .data = stylesheet.data, .count = stylesheet.count }));
+
+	// Pages link stylesheet by path from directory they are written to, so DIR can be any directory
+	char from[PATH_MAX], to[PATH_MAX];
+	absolute_path(site->output_dir ? site->output_dir : ".", from, sizeof(from));
+	absolute_path(site->stylesheet_dir, to, sizeof(to));
+	size_t count = relative_path(from, to, site->stylesheet_href, sizeof(site->stylesheet_href));
+	snprintf(site->stylesheet_href + count, sizeof(site->stylesheet_href) - count, "%s", name);
+	site->config.stylesheet_href = site->stylesheet_href;
+
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/%s", site->stylesheet_dir, name);
+
+	struct stat st;
+	if (stat(path, &st) == 0 && st.st_size == stylesheet.count) {
+		free(stylesheet.data);
+		return;
+	}
 
-	fprintf(out, "<a href=\"" SV_Fmt "\">" SV_Fmt "</a>", SV_Arg(href), SV_Arg(src));
+	FILE *f = fopen(path, "w");
+	if (!f || fwrite(stylesheet.data, 1, stylesheet.count, f) != stylesheet.count || fclose(f) != 0) {
+		fprintf(stderr, "error: while trying to write file '%s': %s\n", path, strerror(errno));
+		exit(5);
+	}
+	free(stylesheet.data);
 }
 
-static void summary(Page const* page)
+// Reads theme once, minifying it if requested.
+static void load_theme(Site *site)
 {
-	char const *title_names[] = {
-		"title", "section", "date", "source", "manual-section"
-	};
-	for (int i = 0; i < Title_Fields; ++i) {
-		printf("%s: " SV_Fmt "\n", title_names[i], SV_Arg(page->title[i]));
+	Msg_Config *config = &site->config;
+	config->theme = read_entire_file(site->theme_path);
+	if (config->minify) {
+		String_View minified = minify_css(config->theme);
+		assert(minified.data);
+		config->theme_minify_saved = config->theme.count - minified.count;
+		free((char*)config->theme.data);
+		config->theme = minified;
 	}
+}
 
-	for (int i = 0; i < page->sections_count; ++i) {
-		printf("SECTION " SV_Fmt "\n", SV_Arg(page->sections[i].name));
-
-		for (int j = 0; j < page->sections[i].commands_count; ++j) {
-			Command *c = &page->sections[i].commands[j];
-			printf("  COMMAND(%d) " SV_Fmt "\n", c->type, SV_Arg(c->value));
-		}
+static uint64_t fnv1a(String_View data)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < data.count; ++i) {
+		hash = (hash ^ (unsigned char)data.data[i]) * 0x100000001b3;
 	}
+	return hash;
 }
 
-static void usage()
+static void usage(char const* program_name)
 {
 	fprintf(stderr,
-		"usage: %s [configuration]\n"
+		"usage: %s [options] [manpage]\n"
+		"       %s [options] [--to=html,text,markdown,json] -o DIR manpage...\n"
+		"       %s [options] --site configuration...\n"
 		"  where configuration is a path to INI file storing site settings\n",
+		program_name, program_name,
 		program_name);
 	exit(1);
 }
 
 static String_View read_entire_file(char const* filename)
+{
+	String_View content;
+	int status = read_file(filename, &content);
+	switch (status) {
+	break; case Read_Open_Failed:
+		fprintf(stderr, "error: while trying to open file '%s': %s", filename, read_error(status));
+		exit(3);
+	break; case Read_Failed: case Read_Corrupted:
+		fprintf(stderr, "error: while trying to read file '%s': %s", filename, read_error(status));
+		exit(4);
+	}
+	return content;
+}
+
+static char const* read_error(int status)
+{
+	return status == Read_Corrupted ? "corrupted or truncated compressed data" : strerror(errno);
+}
+
+// Compressed sources are recognized by magic bytes, not by extension
+static Compression compression_of(String_View head)
+{
+	if (head.count >= 2 && memcmp(head.data, "\x1f\x8b", 2) == 0) {
+		return Compression_Gzip;
+	}
+	if (head.count >= 6 && memcmp(head.data, "\xfd" "7zXZ" "\0", 6) == 0) {
+		return Compression_Xz;
+	}
+	return Compression_None;
+}
+
+// Decompresses stream chunk by chunk straight into buffer that page is parsed from,
+// so neither whole compressed file nor temporary decompressed copy is ever needed.
+typedef struct decoder
+{
+	Compression compression;
+	z_stream gzip;
+	lzma_stream xz;
+	bool done;
+
+	char *data;
+	size_t count;
+	size_t capacity;
+} Decoder;
+
+static void decoder_init(Decoder *d, Compression compression, size_t size_hint)
+{
+	*d = (Decoder) { .compression = compression, .xz = LZMA_STREAM_INIT };
+	// Member of gzip file is detected by header, concatenated xz streams are decoded one after another
+	int ok = compression == Compression_Gzip
+		? inflateInit2(&d->gzip, 16 + MAX_WBITS) == Z_OK
+		: lzma_stream_decoder(&d->xz, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK;
+	assert(ok);
+
+	d->capacity = size_hint > 64 * 1024 ? size_hint : 64 * 1024;
+	d->data = malloc(d->capacity + 1);
+	assert(d->data);
+}
+
+// Makes room for more output, keeping one byte for terminating zero
+static void decoder_grow(Decoder *d)
+{
+	if (d->count < d->capacity) {
+		return;
+	}
+	d->capacity *= 2;
+	d->data = realloc(d->data, d->capacity + 1);
+	assert(d->data);
+}
+
+// Decodes chunk of input, last chunk has to be marked. Returns false on corrupted data.
+static bool decoder_feed(Decoder *d, String_View in, bool last)
+{
+	if (d->compression == Compression_Gzip) {
+		z_stream *z = &d->gzip;
+		z->next_in = (Bytef*)in.data;
+		z->avail_in = in.count;
+		for (;;) {
+			decoder_grow(d);
+			size_t room = d->capacity - d->count;
+			z->next_out = (Bytef*)d->data + d->count;
+			z->avail_out = room < UINT_MAX ? room : UINT_MAX;
+			int result = inflate(z, Z_NO_FLUSH);
+			d->count = (char*)z->next_out - d->data;
+
+			if (result == Z_STREAM_END) {
+				d->done = true;
+				if (z->avail_in == 0) {
+					return true;
+				}
+				// Next member of concatenated gzip file
+				if (inflateReset(z) != Z_OK) {
+					return false;
+				}
+				d->done = false;
+				continue;
+			}
+			if (result == Z_BUF_ERROR && z->avail_in == 0) {
+				return true;
+			}
+			if (result != Z_OK) {
+				return false;
+			}
+			if (z->avail_in == 0 && z->avail_out > 0) {
+				return true;
+			}
+		}
+	}
+
+	lzma_stream *x = &d->xz;
+	x->next_in = (uint8_t const*)in.data;
+	x->avail_in = in.count;
+	for (;;) {
+		decoder_grow(d);
+		x->next_out = (uint8_t*)d->data + d->count;
+		x->avail_out = d->capacity - d->count;
+		lzma_ret result = lzma_code(x, last ? LZMA_FINISH : LZMA_RUN);
+		d->count = (char*)x->next_out - d->data;
+
+		if (result == LZMA_STREAM_END) {
+			d->done = true;
+			return true;
+		}
+		if (result != LZMA_OK) {
+			return false;
+		}
+		if (!last && x->avail_in == 0 && x->avail_out > 0) {
+			return true;
+		}
+	}
+}
+
+// Returns decoded content terminated with zero, or SV_NULL when input was truncated.
+static String_View decoder_finish(Decoder *d)
+{
+	if (d->compression == Compression_Gzip) {
+		inflateEnd(&d->gzip);
+	} else {
+		lzma_end(&d->xz);
+	}
+	if (!d->done) {
+		free(d->data);
+		return SV_NULL;
+	}
+	d->data[d->count] = '\0';
+	return sv_from_parts(d->data, d->count);
+}
+
+// Replaces compressed content, allocated with malloc, with decompressed one.
+// Content that isn't compressed is left as it is.
+static bool decompress(String_View *content)
+{
+	Compression compression = compression_of(*content);
+	if (compression == Compression_None) {
+		return true;
+	}
+
+	Decoder d;
+	decoder_init(&d, compression, 4 * content->count);
+	bool ok = decoder_feed(&d, *content, true);
+	String_View result = decoder_finish(&d);
+	if (!ok || !result.data) {
+		free((char*)result.data);
+		return false;
+	}
+	free((char*)content->data);
+	*content = result;
+	return true;
+}
+
+// Files included with .so may be compressed like pages
+static char const* read_include_file(char const* path, String_View *content)
+{
+	int status = read_file(path, content);
+	return status == Read_Ok ? NULL : read_error(status);
+}
+
+// Compressed file is read in chunks fed to decoder, starting with already read magic bytes.
+static int read_compressed(FILE *f, Compression compression, String_View head, String_View *content)
+{
+	struct stat st;
+	size_t size_hint = fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) ? 4 * st.st_size : 0;
+
+	Decoder d;
+	decoder_init(&d, compression, size_hint);
+	bool ok = decoder_feed(&d, head, false);
+
+	char chunk[64 * 1024];
+	while (ok) {
+		size_t read = fread(chunk, 1, sizeof(chunk), f);
+		if (read == 0 && ferror(f)) {
+			decoder_finish(&d);
+			return Read_Failed;
+		}
+		ok = decoder_feed(&d, sv_from_parts(chunk, read), read == 0);
+		if (read == 0) {
+			break;
+		}
+	}
+
+	*content = decoder_finish(&d);
+	if (!ok || !content->data) {
+		free((char*)content->data);
+		return Read_Corrupted;
+	}
+	return Read_Ok;
+}
+
+// Reads whole file into buffer terminated with zero, leaving errno on failure.
+// Files compressed with gzip or xz are decompressed while reading.
+static int read_file(char const* filename, String_View *content)
 {
 	FILE *f = filename[0] == '-' && filename[1] == '\0'
 		? stdin
 		: fopen(filename, "r");
 
 	if (!f) {
-		fprintf(stderr, "error: while trying to open file '%s': %s", filename, strerror(errno));
-		exit(3);
+		return Read_Open_Failed;
+	}
+
+	struct stat st;
+	if (fstat(fileno(f), &st) == 0 && S_ISDIR(st.st_mode)) {
+		fclose(f);
+		errno = EISDIR;
+		return Read_Failed;
+	}
+
+	char magic[6];
+	size_t magic_count = fread(magic, 1, sizeof(magic), f);
+	Compression compression = compression_of(sv_from_parts(magic, magic_count));
+	if (compression != Compression_None) {
+		int status = read_compressed(f, compression, sv_from_parts(magic, magic_count), content);
+		fclose(f);
+		return status;
 	}
 
 	fseek(f, 0, SEEK_END);
 	long size = ftell(f);
 	fseek(f, 0, SEEK_SET);
-	char *buffer = calloc(size + 1, 1);
+	char *buffer = size >= 0 ? calloc(size + 1, 1) : NULL;
+	if (!buffer) {
+		fclose(f);
+		return Read_Failed;
+	}
 
-	String_View content = {
+	*content = (String_View) {
 		.data  = buffer,
 		.count = size,
 	};
@@ -284,28 +2924,11 @@ static String_View read_entire_file(char const* filename)
 		buffer += read;
 	} while (size);
 
+	fclose(f);
 	if (size) {
-		fprintf(stderr, "error: while trying to read file '%s': %s", filename, strerror(errno));
-		fclose(f);
-		exit(4);
+		free((char*)content->data);
+		return Read_Failed;
 	}
-
-	fclose(f);
-	return content;
+	return Read_Ok;
 }
 
-static void ensure_enough_space(void **mem, size_t element_size, size_t desired_count, size_t *capacity)
-{
-	if (desired_count < *capacity) {
-		return;
-	}
-
-	size_t new_capacity = *capacity > 0 ? desired_count * 2 : 8;
-
-	*mem = *mem ? realloc(*mem, new_capacity * element_size) : malloc(new_capacity * element_size);
-	assert(*mem);
-
-	void *old_end = *mem + element_size * *capacity;
-	memset(old_end, 0, (new_capacity - *capacity) * element_size);
-	*capacity = new_capacity;
-}
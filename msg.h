@@ -0,0 +1,3972 @@
+// msg - library that turns manpage like documents into HTML
+//
+// Parses document from memory into Page and renders it either as list of
+// slices (Output, written with writev) or into caller supplied growable
+// buffer (Msg_Buffer). Library doesn't read configuration from globals,
+// doesn't exit and doesn't print; all settings are in Msg_Config and
+// problems are reported through its diagnostic callback.
+//
+// Define MSG_IMPLEMENTATION in exactly one translation unit before including
+// this file. Library uses String_View from sv.h, which it includes, so define
+// SV_IMPLEMENTATION next to it unless sv.h is implemented elsewhere.
+// Large pages are parsed and rendered with POSIX threads, so link with -lpthread.
+// Files included with .so are read by parse_page, see Msg_Config::read_include.
+
+#ifndef MSG_H_
+#define MSG_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "sv.h"
+
+#ifndef MSGDEF
+#define MSGDEF
+#endif // MSGDEF
+
+// Value of command points into source, or into buffers of page when its escapes
+// were translated to HTML. Macros keep their arguments unsplit, quoted arguments
+// are separated by renderer.
+typedef struct command
+{
+	enum {
+		Text,
+		Link,
+		Subsection,         // .SS heading
+		Paragraph,          // .PP, .LP, .P
+		Tagged_Paragraph,   // .TP, tag is the next command
+		Indented_Paragraph, // .IP tag
+		Hanging_Paragraph,  // .HP
+		Indent,             // .RS
+		Unindent,           // .RE
+		Bold,               // .B text
+		Italic,             // .I text
+		Bold_Roman,         // .BR, .IR, .RB, .RI, .BI, .IB alternate fonts of arguments
+		Italic_Roman,
+		Roman_Bold,
+		Roman_Italic,
+		Bold_Italic,
+		Italic_Bold,
+		No_Fill,            // .nf, .EX, .Bd -literal
+		Fill,               // .fi, .EE
+		// mdoc
+		Name,               // .Nm, value is name of page when .Nm has no arguments
+		Description,        // .Nd one-liner
+		Inline,             // line of words and callable macros, like .Fl a Ar file
+		List_Begin,         // .Bl, first argument is type of list
+		List_End,           // .El
+		List_Item,          // .It
+		Preformatted,       // lines between .nf and .fi, value spans all of them
+		Include,            // .so, replaced by commands of included file when page is parsed
+		Command_Types,
+	} type;
+	String_View value;
+} Command;
+
+typedef struct section
+{
+	String_View name;
+
+	Command *commands;
+	size_t commands_count;
+	size_t commands_capacity;
+} Section;
+
+#define Title_Fields 5
+
+typedef struct page
+{
+	char const* path;
+	String_View source;
+	String_View title[Title_Fields];
+
+	Section *sections;
+	size_t sections_count;
+	size_t sections_capacity;
+
+	// Text generated while parsing, like expansions of macros, that commands may point into
+	char **buffers;
+	size_t buffers_count;
+	size_t buffers_capacity;
+} Page;
+
+// Rendered page as list of slices pointing into static markup, configuration
+// and source buffer of the page, written to file descriptor with writev.
+// Slices adjacent in memory are merged, so runs of text become single slice.
+// Source buffer must stay alive until output is written.
+//
+// When buffer is set, content is copied into it instead of collected as slices.
+typedef struct output
+{
+	struct iovec *parts;
+	size_t parts_count;
+	size_t parts_capacity;
+	size_t parts_written;
+	size_t bytes;
+	size_t minify_saved;
+
+	// Text generated while rendering, like anchors, lives in blocks that never move,
+	// so slices pointing to it stay valid until output is freed
+	char **blocks;
+	size_t blocks_count;
+	size_t blocks_capacity;
+	size_t block_used;
+
+	struct msg_buffer *buffer;
+	bool failed;
+} Output;
+
+// Page as listed in index of site.
+typedef struct index_entry
+{
+	String_View name;
+	String_View section;
+	String_View date;
+	String_View description;
+	// Names listed in NAME section before its one-liner, like "gzip, gunzip, zcat"
+	String_View names;
+	String_View href;
+} Index_Entry;
+
+// Growable buffer owned by caller. It may start empty or with preallocated
+// memory from malloc, library grows it with realloc and only appends to it.
+typedef struct msg_buffer
+{
+	char *data;
+	size_t count;
+	size_t capacity;
+} Msg_Buffer;
+
+typedef struct msg_diagnostic
+{
+	enum {
+		Msg_Warning,
+		Msg_Error,
+	} severity;
+	char const* path;
+	// Both counted from 1, zero when diagnostic isn't about particular place
+	size_t line;
+	size_t column;
+	String_View message;
+} Msg_Diagnostic;
+
+typedef struct msg_config
+{
+	// Content of stylesheet inlined into every page, unless stylesheet_href is set
+	String_View theme;
+	// How many bytes minify_css removed from theme, reported in Output::minify_saved
+	size_t theme_minify_saved;
+	// When set, pages link to this stylesheet instead of inlining theme and colors
+	char const* stylesheet_href;
+
+	// Absolute URL of site without trailing slash, prefix of links in sitemap and feed
+	char const* base_url;
+
+	// Hues of colors used by theme
+	char const* background_color;
+	char const* text_color;
+	char const* accent_color;
+
+	bool minify;
+	// Adds table of contents linking to anchors of sections
+	bool toc;
+	// Budgets of single file of paginated page, zero means unlimited. See paginate_page.
+	size_t max_bytes;
+	size_t max_commands;
+
+	// Threads that parse and render single large page, split at .SH boundaries.
+	// Result is the same as with single thread, including order of diagnostics.
+	size_t jobs;
+
+	// Called for every warning and error, may be NULL
+	void (*diagnostic)(void *data, Msg_Diagnostic const* diagnostic);
+	void *diagnostic_data;
+
+	// Reads file included with .so into buffer allocated with malloc, that is never freed.
+	// Returns NULL when file was read, or message telling why it couldn't be.
+	// When NULL, files are read as they are, without decompression.
+	char const* (*read_include)(char const* path, String_View *content);
+} Msg_Config;
+
+MSGDEF Msg_Config msg_default_config(void);
+
+// Parses src into page. Page points into src, so it must outlive the page.
+// Returns false when document is malformed, error is reported through diagnostic callback.
+MSGDEF bool parse_page(Msg_Config const* config, char const* path, String_View src, Page *page);
+MSGDEF void free_page(Page *page);
+
+// Renders page as slices into out, zero copy.
+MSGDEF bool print_page_to(Msg_Config const* config, Page const* page, Output *out);
+// Splits page at section boundaries into parts, so that HTML of every part stays within
+// max_bytes and max_commands of config. Section that alone exceeds budget gets part of its own.
+// Sets *breaks to array with index of first section of every part, that caller frees,
+// and returns number of parts. Name is used in links between parts, see print_page_part_to.
+MSGDEF size_t paginate_page(Msg_Config const* config, Page const* page, char const* name, size_t **breaks);
+// Renders one part of paginated page with the same header and footer as whole page
+// and links to previous and next part. First part links to <name>.html, others to <name>.<n>.html.
+MSGDEF bool print_page_part_to(Msg_Config const* config, Page const* page, size_t const* breaks, size_t parts_count, size_t part, char const* name, Output *out);
+// Formats that page can be rendered to. Every format is backend with the same
+// interface as print_page_to, so page parsed once can be rendered to all of them,
+// also from several threads at once since rendering only reads page.
+typedef enum {
+	Msg_Html,
+	Msg_Text,     // plain text for terminals, indented like man(1)
+	Msg_Markdown,
+	Msg_Json,     // {"title": {...}, "sections": [{"name": ..., "text": ...}]}, text as in Msg_Text
+	Msg_Formats,
+} Msg_Format;
+
+// Renders page in given format as slices into out, zero copy where text needs no escaping.
+MSGDEF bool render_page_as(Msg_Config const* config, Msg_Format format, Page const* page, Output *out);
+// Returns format of given name (html, text, markdown or json), Msg_Formats when there is none.
+MSGDEF Msg_Format msg_format_from_name(String_View name);
+// Returns extension of files in format, including dot, like ".md".
+MSGDEF char const* msg_format_extension(Msg_Format format);
+// Renders page by appending HTML to buffer.
+MSGDEF bool render_page(Msg_Config const* config, Page const* page, Msg_Buffer *buffer);
+// Renders index page listing entries in given order.
+MSGDEF bool print_index_to(Msg_Config const* config, Index_Entry const* entries, size_t count, Output *out);
+// Renders sitemap (sitemaps.org protocol) listing entries as URLs under base_url of config.
+// Protocol allows at most Msg_Sitemap_Limit URLs in one file.
+MSGDEF bool print_sitemap_to(Msg_Config const* config, Index_Entry const* entries, size_t count, Output *out);
+// Renders sitemap index linking to sitemap-1.xml .. sitemap-<count>.xml under base_url of config.
+MSGDEF bool print_sitemap_index_to(Msg_Config const* config, size_t count, Output *out);
+// Renders Atom feed of Msg_Feed_Limit most recent entries, which have date in YYYY-MM-DD form.
+MSGDEF bool print_feed_to(Msg_Config const* config, Index_Entry const* entries, size_t count, Output *out);
+// Returns one-liner description of page from its NAME section.
+MSGDEF String_View page_description(Page const* page);
+// Returns names that NAME section lists before one-liner, separated by commas.
+MSGDEF String_View page_names(Page const* page);
+// Renders stylesheet combining colors and theme, for use with stylesheet_href.
+MSGDEF bool render_stylesheet(Msg_Config const* config, Msg_Buffer *buffer);
+
+// Returns minified copy of css allocated with malloc, or SV_NULL when out of memory.
+MSGDEF String_View minify_css(String_View css);
+// Returns length of valid UTF-8 sequence that starts at byte i of text, or 0 when there is none.
+// Writers of JSON replace bytes that don't start one with U+FFFD.
+MSGDEF size_t msg_utf8_length(String_View text, size_t i);
+
+#define Msg_Sitemap_Limit 50000
+#define Msg_Feed_Limit 50
+
+MSGDEF void out_sv(Output *out, String_View sv);
+MSGDEF void out_cstr(Output *out, char const* cstr);
+// Returns memory for size bytes of generated text, that stays valid until out_free
+MSGDEF char* out_reserve(Output *out, size_t size);
+// Skips parts that were already written, adjusting partially written one
+MSGDEF void out_advance(Output *out, size_t written);
+// Writes all remaining parts to fd, returns false and sets errno on failure
+MSGDEF bool out_write(Output *out, int fd);
+MSGDEF void out_free(Output *out);
+
+MSGDEF void ensure_enough_space(void **mem, size_t element_size, size_t desired_count, size_t *capacity);
+
+#define Push(array, field) \
+		ensure_enough_space((void**)&(array).field, sizeof((array).field[0]), ++((array).field##_count), &(array).field##_capacity);
+
+#define Back(array, field) \
+	(&((array).field[(array).field##_count-1]))
+
+#endif // MSG_H_
+
+#ifdef MSG_IMPLEMENTATION
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define Output_Block_Size 4096
+
+static void msg_report(Msg_Config const* config, int severity, char const* path, size_t line, size_t column, char const* fmt, ...)
+{
+	if (!config->diagnostic) {
+		return;
+	}
+
+	char message[512];
+	va_list args;
+	va_start(args, fmt);
+	int count = vsnprintf(message, sizeof(message), fmt, args);
+	va_end(args);
+
+	Msg_Diagnostic diagnostic = {
+		.severity = severity,
+		.path = path,
+		.line = line,
+		.column = column,
+		.message = sv_from_parts(message, count < sizeof(message) ? count : sizeof(message) - 1),
+	};
+	config->diagnostic(config->diagnostic_data, &diagnostic);
+}
+
+MSGDEF Msg_Config msg_default_config(void)
+{
+	return (Msg_Config) {
+		.background_color = "300",
+		.text_color = "45",
+		.accent_color = "168",
+	};
+}
+
+typedef enum {
+	Dialect_Man,
+	Dialect_Mdoc,
+} Dialect;
+
+// Names of requests are packed into integer, so they are dispatched with single switch
+#define Macro1(a)       ((uint32_t)(a))
+#define Macro2(a, b)    ((uint32_t)(a) << 8 | (uint32_t)(b))
+#define Macro3(a, b, c) ((uint32_t)(a) << 16 | (uint32_t)(b) << 8 | (uint32_t)(c))
+
+static uint32_t macro_code(String_View name)
+{
+	if (name.count == 0 || name.count > 4) {
+		return 0;
+	}
+	uint32_t code = 0;
+	for (size_t i = 0; i < name.count; ++i) {
+		code = code << 8 | (unsigned char)name.data[i];
+	}
+	return code;
+}
+
+static bool msg_is_name(char c)
+{
+	return c != ' ' && c != '\t';
+}
+
+// Splits next argument of macro, arguments in double quotes may contain spaces
+static bool next_argument(String_View *args, String_View *arg)
+{
+	*args = sv_trim_left(*args);
+	if (args->count == 0) {
+		return false;
+	}
+	if (args->data[0] != '"') {
+		*arg = sv_chop_by_delim(args, ' ');
+		return true;
+	}
+	sv_chop_left(args, 1);
+	size_t i = 0;
+	while (i < args->count && args->data[i] != '"') {
+		++i;
+	}
+	*arg = sv_from_parts(args->data, i);
+	sv_chop_left(args, i + (i < args->count));
+	return true;
+}
+
+// Requests that change page instead of adding command to it
+enum {
+	Request_Unknown = -1,
+	Request_Ignored = -2,
+	Request_Title = -3,        // .TH
+	Request_Section = -4,      // .SH, .Sh
+	Request_Date = -5,         // .Dd
+	Request_Document = -6,     // .Dt
+	Request_System = -7,       // .Os
+	Request_Display = -8,      // .Bd
+	Request_Display_End = -9,  // .Ed
+	Request_Display_Line = -10, // .Dl, .D1
+	Request_Define = -11,       // .de
+	Request_Append = -12,       // .am
+	Request_String = -13,       // .ds
+	Request_String_Append = -14, // .as
+	Request_Register = -15,     // .nr
+	Request_Remove = -16,       // .rm, .rr
+	Request_If = -17,           // .if
+	Request_If_Else = -18,      // .ie
+	Request_Else = -19,         // .el
+};
+
+// Requests of roff itself, shared by both dialects
+static int roff_request(uint32_t code)
+{
+	switch (code) {
+	case Macro2('s','o'): return Include;
+	case Macro2('d','e'): case Macro3('d','e','1'): return Request_Define;
+	case Macro2('a','m'): case Macro3('a','m','1'): return Request_Append;
+	case Macro2('d','s'): case Macro3('d','s','1'): return Request_String;
+	case Macro2('a','s'): case Macro3('a','s','1'): return Request_String_Append;
+	case Macro2('n','r'): return Request_Register;
+	case Macro2('r','m'): case Macro2('r','r'): return Request_Remove;
+	case Macro2('i','f'): return Request_If;
+	case Macro2('i','e'): return Request_If_Else;
+	case Macro2('e','l'): return Request_Else;
+	}
+	return Request_Unknown;
+}
+
+static int man_request(uint32_t code)
+{
+	switch (code) {
+	case Macro2('T','H'): return Request_Title;
+	case Macro2('S','H'): return Request_Section;
+	case Macro2('L','N'): return Link;
+	case Macro2('S','S'): return Subsection;
+	case Macro2('P','P'): case Macro2('L','P'): case Macro1('P'): return Paragraph;
+	case Macro2('T','P'): return Tagged_Paragraph;
+	case Macro2('I','P'): return Indented_Paragraph;
+	case Macro2('H','P'): return Hanging_Paragraph;
+	case Macro2('R','S'): return Indent;
+	case Macro2('R','E'): return Unindent;
+	case Macro1('B'):     return Bold;
+	case Macro1('I'):     return Italic;
+	case Macro2('B','R'): return Bold_Roman;
+	case Macro2('I','R'): return Italic_Roman;
+	case Macro2('R','B'): return Roman_Bold;
+	case Macro2('R','I'): return Roman_Italic;
+	case Macro2('B','I'): return Bold_Italic;
+	case Macro2('I','B'): return Italic_Bold;
+	case Macro2('n','f'): case Macro2('E','X'): return No_Fill;
+	case Macro2('f','i'): case Macro2('E','E'): return Fill;
+	}
+	return roff_request(code);
+}
+
+// How words following callable mdoc macro are printed
+typedef enum {
+	Style_None,
+	Style_Plain,
+	Style_Bold,
+	Style_Italic,
+	Style_Argument,      // italic, "file ..." when there are no words
+	Style_Flag,          // words prefixed with -
+	Style_Reference,     // name(section)
+	Style_No_Space,
+	Style_Skip,          // macro that only groups others, like .Xo
+	// Enclose rest of line
+	Style_Optional,
+	Style_Quoted,
+	Style_Single_Quoted,
+	Style_Parenthesized,
+	Style_Angled,
+	// Enclose everything between them, even over several lines
+	Style_Open_Optional,
+	Style_Close_Optional,
+	Style_Open_Parenthesis,
+	Style_Close_Parenthesis,
+} Style;
+
+static Style mdoc_style(uint32_t code)
+{
+	switch (code) {
+	case Macro2('N','m'): case Macro2('C','m'): case Macro2('I','c'): case Macro2('L','i'): case Macro2('S','y'):
+	case Macro2('C','d'): case Macro2('F','d'): case Macro2('I','n'): case Macro2('F','n'): case Macro2('F','o'):
+	case Macro2('M','s'):
+		return Style_Bold;
+	case Macro2('A','r'): return Style_Argument;
+	case Macro2('E','m'): case Macro2('P','a'): case Macro2('V','a'): case Macro2('E','v'):
+	case Macro2('F','a'): case Macro2('F','t'): case Macro2('D','v'): case Macro2('E','r'): case Macro2('V','t'):
+	case Macro2('A','d'): case Macro2('M','t'): case Macro2('T','n'): case Macro2('S','x'):
+		return Style_Italic;
+	case Macro2('N','o'): case Macro2('P','f'): case Macro2('T','a'): case Macro2('A','n'): case Macro2('L','k'):
+	case Macro2('S','t'): case Macro2('A','t'): case Macro2('B','x'): case Macro2('F','x'): case Macro2('N','x'):
+	case Macro2('O','x'): case Macro2('U','x'): case Macro3('B','s','x'): case Macro2('D','x'):
+	case Macro2('L','b'): case Macro2('F','c'):
+		return Style_Plain;
+	case Macro2('F','l'): return Style_Flag;
+	case Macro2('X','r'): return Style_Reference;
+	case Macro2('N','s'): case Macro2('A','p'): return Style_No_Space;
+	case Macro2('X','o'): case Macro2('X','c'): case Macro2('B','k'): case Macro2('E','k'): return Style_Skip;
+	case Macro2('O','p'): case Macro2('B','q'): return Style_Optional;
+	case Macro2('D','q'): case Macro2('Q','q'): return Style_Quoted;
+	case Macro2('S','q'): case Macro2('Q','l'): return Style_Single_Quoted;
+	case Macro2('P','q'): return Style_Parenthesized;
+	case Macro2('A','q'): return Style_Angled;
+	case Macro2('O','o'): case Macro2('B','o'): return Style_Open_Optional;
+	case Macro2('O','c'): case Macro2('B','c'): return Style_Close_Optional;
+	case Macro2('P','o'): return Style_Open_Parenthesis;
+	case Macro2('P','c'): return Style_Close_Parenthesis;
+	}
+	return Style_None;
+}
+
+static int mdoc_request(uint32_t code)
+{
+	switch (code) {
+	case Macro2('D','d'): return Request_Date;
+	case Macro2('D','t'): return Request_Document;
+	case Macro2('O','s'): return Request_System;
+	case Macro2('S','h'): return Request_Section;
+	case Macro2('S','s'): return Subsection;
+	case Macro2('P','p'): case Macro2('L','p'): return Paragraph;
+	case Macro2('N','m'): return Name;
+	case Macro2('N','d'): return Description;
+	case Macro2('B','l'): return List_Begin;
+	case Macro2('E','l'): return List_End;
+	case Macro2('I','t'): return List_Item;
+	case Macro2('B','d'): return Request_Display;
+	case Macro2('E','d'): return Request_Display_End;
+	case Macro2('D','l'): case Macro2('D','1'): return Request_Display_Line;
+	case Macro2('B','k'): case Macro2('E','k'): case Macro2('X','o'): case Macro2('X','c'):
+	case Macro2('S','m'): case Macro2('T','g'): case Macro2('R','s'): case Macro2('R','e'):
+	case Macro2('B','f'): case Macro2('E','f'):
+		return Request_Ignored;
+	}
+	return mdoc_style(code) != Style_None ? Inline : roff_request(code);
+}
+
+// Splits control line into request name and its arguments, returns false for comments and empty requests
+static bool split_request(String_View line, String_View *name, String_View *args)
+{
+	String_View request = line;
+	sv_chop_left(&request, 1);
+	if (sv_starts_with(request, SV("\\\"")) || sv_trim(request).count == 0) {
+		return false;
+	}
+	request = sv_trim_left(request);
+	*name = sv_take_left_while(request, msg_is_name);
+	sv_chop_left(&request, name->count);
+	*args = sv_trim_left(request);
+	return true;
+}
+
+static bool is_control_line(String_View line)
+{
+	return line.count > 0 && (line.data[0] == '.' || line.data[0] == '\'');
+}
+
+// Pages in mdoc start with .Dd, everything else is read as man
+static Dialect dialect_of(String_View src)
+{
+	while (src.count > 0) {
+		String_View line = sv_chop_by_delim(&src, '\n'), name, args;
+		if (is_control_line(line) && split_request(line, &name, &args)) {
+			return macro_code(name) == Macro2('D','d') ? Dialect_Mdoc : Dialect_Man;
+		}
+	}
+	return Dialect_Man;
+}
+
+static void push_command(Page *page, int type, String_View value)
+{
+	Section *last = Back(*page, sections);
+	Push(*last, commands);
+	*Back(*last, commands) = (Command) { .type = type, .value = value };
+}
+
+// Body of macro defined with .de is split once into literal text and references to arguments
+enum {
+	Macro_Literal = 0,
+	// 1 to 9 are \$1 to \$9
+	Macro_All_Arguments = 10, // \$* and \$@
+	Macro_Line_End = 11,
+};
+
+typedef struct macro_token
+{
+	int kind;
+	String_View text;
+} Macro_Token;
+
+typedef struct macro
+{
+	String_View name;
+	Macro_Token *tokens;
+	size_t tokens_count;
+	size_t tokens_capacity;
+} Macro;
+
+// Deepest nesting of macro calls, macros calling themselves stop there
+#define Msg_Macro_Depth 64
+
+// Name shared by string and number register, like in troff
+typedef struct symbol
+{
+	String_View name;
+	String_View string;
+	long number;
+	bool has_string;
+	bool has_number;
+} Symbol;
+
+// State of parsing of one file, that lasts between lines
+typedef struct parser
+{
+	Msg_Config const* config;
+	Dialect dialect;
+	bool fragment;
+	Page page;
+	size_t line_number;
+
+	// Some requests take their argument from the next line
+	enum {
+		Pending_None,
+		Pending_Section,
+		Pending_Command,
+	} pending;
+
+	// Name from first .Nm of mdoc page, used by .Nm without arguments
+	String_View name_of_page;
+	// Bit for every open .Bd, set when it is literal
+	uint32_t displays;
+
+	// Macros defined by page, by hash of name, empty slots have no name.
+	// Size is power of two, at most half of slots is used.
+	Macro *macros;
+	size_t macros_count;
+	size_t macros_size;
+	// Macro whose body is being read, until line with terminator (".." by default)
+	Macro *defining;
+	String_View terminator;
+	size_t depth;
+
+	// Strings (.ds) and number registers (.nr) by interned name, see intern
+	Symbol *symbols;
+	size_t symbols_count;
+	size_t symbols_size;
+
+	// Nesting of \{ blocks skipped by false condition, zero when lines are parsed
+	long skipping;
+	// Results of .ie waiting for their .el, last one in lowest bit
+	uint64_t conditions;
+
+	// Generated text is stored in chunks owned by page, last one has room left
+	char *arena;
+	size_t arena_left;
+	// Reused for every translated line
+	Msg_Buffer scratch;
+
+	// Consecutive text lines are collected into single range, which becomes
+	// one command at first request or blank line after them: paragraph of Text,
+	// or Preformatted between .nf and .fi
+	String_View lines;
+	size_t lines_line_number; // where collected lines start, for diagnostics
+	bool no_fill;
+	// Line after .TP is its tag and stays on its own
+	bool tag_next;
+} Parser;
+
+static Macro* find_macro(Parser *parser, String_View name, bool create)
+{
+	if (parser->macros_count == 0 && !create) {
+		return NULL;
+	}
+	if (create && 2 * (parser->macros_count + 1) > parser->macros_size) {
+		Macro *old = parser->macros;
+		size_t old_size = parser->macros_size;
+		parser->macros_size = old_size ? 2 * old_size : 16;
+		parser->macros = calloc(parser->macros_size, sizeof(*parser->macros));
+		assert(parser->macros);
+		parser->macros_count = 0;
+		for (size_t i = 0; i < old_size; ++i) {
+			if (old[i].name.data) {
+				*find_macro(parser, old[i].name, true) = old[i];
+			}
+		}
+		free(old);
+	}
+
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < name.count; ++i) {
+		hash = (hash ^ (unsigned char)name.data[i]) * 0x100000001b3;
+	}
+	for (size_t i = hash & (parser->macros_size - 1);; i = (i + 1) & (parser->macros_size - 1)) {
+		Macro *macro = &parser->macros[i];
+		if (!macro->name.data) {
+			if (!create) {
+				return NULL;
+			}
+			macro->name = name;
+			parser->macros_count += 1;
+			return macro;
+		}
+		if (sv_eq(macro->name, name)) {
+			return macro;
+		}
+	}
+}
+
+static void free_macros(Parser *parser)
+{
+	for (size_t i = 0; i < parser->macros_size; ++i) {
+		free(parser->macros[i].tokens);
+	}
+	free(parser->macros);
+}
+
+static void push_token(Macro *macro, int kind, String_View text)
+{
+	// Adjacent literals come from \\ in the middle of text
+	if (kind == Macro_Literal && macro->tokens_count > 0) {
+		Macro_Token *last = Back(*macro, tokens);
+		if (last->kind == Macro_Literal && last->text.data + last->text.count == text.data) {
+			last->text.count += text.count;
+			return;
+		}
+	}
+	Push(*macro, tokens);
+	*Back(*macro, tokens) = (Macro_Token) { .kind = kind, .text = text };
+}
+
+// Splits line of macro body into tokens. Body is read in copy mode,
+// where \\ stands for single backslash, so \\$1 means the same as \$1.
+static void define_line(Macro *macro, String_View line)
+{
+	size_t start = 0;
+	for (size_t i = 0; i < line.count; ++i) {
+		if (line.data[i] != '\\') {
+			continue;
+		}
+		size_t dollar = i + 1 < line.count && line.data[i + 1] == '\\' ? i + 2 : i + 1;
+		if (dollar + 1 < line.count && line.data[dollar] == '$') {
+			char c = line.data[dollar + 1];
+			int kind = c >= '1' && c <= '9' ? c - '0' : c == '*' || c == '@' ? Macro_All_Arguments : Macro_Literal;
+			if (kind != Macro_Literal) {
+				push_token(macro, Macro_Literal, sv_from_parts(line.data + start, i - start));
+				push_token(macro, kind, SV_NULL);
+				i = dollar + 1;
+				start = i + 1;
+				continue;
+			}
+		}
+		if (dollar == i + 2) {
+			// Keep first backslash of pair and skip the second one
+			push_token(macro, Macro_Literal, sv_from_parts(line.data + start, i + 1 - start));
+			i += 1;
+			start = i + 1;
+		}
+	}
+	push_token(macro, Macro_Literal, sv_from_parts(line.data + start, line.count - start));
+	push_token(macro, Macro_Line_End, SV_NULL);
+}
+
+// Chunk of text generated while parsing, small strings share it
+#define Msg_Arena_Size (64 * 1024)
+
+// Returns memory for size bytes that lives as long as page
+static char* page_alloc(Parser *parser, size_t size)
+{
+	if (size > parser->arena_left) {
+		size_t chunk = size > Msg_Arena_Size ? size : Msg_Arena_Size;
+		char *data = malloc(chunk);
+		assert(data);
+		Push(parser->page, buffers);
+		*Back(parser->page, buffers) = data;
+		// Large allocation gets chunk of its own, so current chunk stays usable
+		if (size > Msg_Arena_Size) {
+			return data;
+		}
+		parser->arena = data;
+		parser->arena_left = chunk;
+	}
+	char *result = parser->arena;
+	parser->arena += size;
+	parser->arena_left -= size;
+	return result;
+}
+
+static String_View page_store(Parser *parser, String_View text)
+{
+	// Empty text is still text, unlike SV_NULL
+	if (text.count == 0) {
+		return SV("");
+	}
+	char *data = page_alloc(parser, text.count);
+	memcpy(data, text.data, text.count);
+	return sv_from_parts(data, text.count);
+}
+
+// Returns symbol of given name, creating it when asked, or NULL
+static Symbol* intern(Parser *parser, String_View name, bool create)
+{
+	if (parser->symbols_count == 0 && !create) {
+		return NULL;
+	}
+	if (create && 2 * (parser->symbols_count + 1) > parser->symbols_size) {
+		Symbol *old = parser->symbols;
+		size_t old_size = parser->symbols_size;
+		parser->symbols_size = old_size ? 2 * old_size : 64;
+		parser->symbols = calloc(parser->symbols_size, sizeof(*parser->symbols));
+		assert(parser->symbols);
+		parser->symbols_count = 0;
+		for (size_t i = 0; i < old_size; ++i) {
+			if (old[i].name.data) {
+				*intern(parser, old[i].name, true) = old[i];
+			}
+		}
+		free(old);
+	}
+
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < name.count; ++i) {
+		hash = (hash ^ (unsigned char)name.data[i]) * 0x100000001b3;
+	}
+	for (size_t i = hash & (parser->symbols_size - 1);; i = (i + 1) & (parser->symbols_size - 1)) {
+		Symbol *symbol = &parser->symbols[i];
+		if (!symbol->name.data) {
+			if (!create) {
+				return NULL;
+			}
+			symbol->name = name;
+			parser->symbols_count += 1;
+			return symbol;
+		}
+		if (sv_eq(symbol->name, name)) {
+			return symbol;
+		}
+	}
+}
+
+// Reads name of escape like \*x, \*(xx or \*[name] after its letter
+static String_View escape_name(String_View *rest)
+{
+	if (rest->count == 0) {
+		return SV_NULL;
+	}
+	String_View name;
+	if (rest->data[0] == '(') {
+		name = sv_from_parts(rest->data + 1, rest->count >= 3 ? 2 : rest->count - 1);
+		sv_chop_left(rest, 1 + name.count);
+	} else if (rest->data[0] == '[') {
+		char const* close = memchr(rest->data, ']', rest->count);
+		name = sv_from_parts(rest->data + 1, close ? close - rest->data - 1 : rest->count - 1);
+		sv_chop_left(rest, close ? name.count + 2 : rest->count);
+	} else {
+		name = sv_from_parts(rest->data, 1);
+		sv_chop_left(rest, 1);
+	}
+	return name;
+}
+
+static long register_value(Parser *parser, String_View name)
+{
+	Symbol const* symbol = intern(parser, name, false);
+	return symbol && symbol->has_number ? symbol->number : 0;
+}
+
+static long eval_expression(Parser *parser, String_View *expr);
+
+static long eval_term(Parser *parser, String_View *expr)
+{
+	if (expr->count == 0) {
+		return 0;
+	}
+	switch (expr->data[0]) {
+	case '(': {
+		sv_chop_left(expr, 1);
+		long value = eval_expression(parser, expr);
+		if (expr->count && expr->data[0] == ')') {
+			sv_chop_left(expr, 1);
+		}
+		return value;
+	}
+	case '-': sv_chop_left(expr, 1); return -eval_term(parser, expr);
+	case '+': sv_chop_left(expr, 1); return eval_term(parser, expr);
+	case '\\':
+		if (expr->count >= 2 && expr->data[1] == 'n') {
+			sv_chop_left(expr, 2);
+			if (expr->count && (expr->data[0] == '+' || expr->data[0] == '-')) {
+				sv_chop_left(expr, 1);
+			}
+			return register_value(parser, escape_name(expr));
+		}
+		if (expr->count >= 3 && expr->data[1] == 'w') {
+			// Width of text isn't known without typesetting, only whether it has any
+			char const* close = memchr(expr->data + 3, expr->data[2], expr->count - 3);
+			long width = close ? close - expr->data - 3 : 0;
+			sv_chop_left(expr, close ? close - expr->data + 1 : expr->count);
+			return width;
+		}
+		sv_chop_left(expr, 2);
+		return 0;
+	}
+
+	long value = 0;
+	while (expr->count && isdigit((unsigned char)expr->data[0])) {
+		value = value * 10 + (expr->data[0] - '0');
+		sv_chop_left(expr, 1);
+	}
+	// Fractions and scale indicators don't matter for text
+	if (expr->count && expr->data[0] == '.') {
+		sv_chop_left(expr, 1);
+		while (expr->count && isdigit((unsigned char)expr->data[0])) {
+			sv_chop_left(expr, 1);
+		}
+	}
+	if (expr->count && strchr("uicpmnvPMsf", expr->data[0])) {
+		sv_chop_left(expr, 1);
+	}
+	return value;
+}
+
+// Evaluates numeric expression strictly left to right, troff has no precedence of operators.
+// Expression ends at space or at character that isn't part of it.
+static long eval_expression(Parser *parser, String_View *expr)
+{
+	long value = eval_term(parser, expr);
+	while (expr->count > 0) {
+		static char const* const operators[] = {
+			"<=", ">=", "==", "!=", "<>", "=", "<", ">", "+", "-", "*", "/", "%", "&", ":",
+		};
+		size_t op = 0, count = sizeof(operators) / sizeof(*operators);
+		while (op < count && !sv_starts_with(*expr, sv_from_cstr(operators[op]))) {
+			++op;
+		}
+		if (op == count) {
+			break;
+		}
+		sv_chop_left(expr, strlen(operators[op]));
+		long rhs = eval_term(parser, expr);
+		switch (op) {
+		break; case 0:  value = value <= rhs;
+		break; case 1:  value = value >= rhs;
+		break; case 2:  value = value == rhs;
+		break; case 3: case 4: value = value != rhs;
+		break; case 5:  value = value == rhs;
+		break; case 6:  value = value < rhs;
+		break; case 7:  value = value > rhs;
+		break; case 8:  value = value + rhs;
+		break; case 9:  value = value - rhs;
+		break; case 10: value = value * rhs;
+		break; case 11: value = rhs ? value / rhs : 0;
+		break; case 12: value = rhs ? value % rhs : 0;
+		break; case 13: value = value > 0 && rhs > 0;
+		break; case 14: value = value > 0 || rhs > 0;
+		}
+	}
+	return value;
+}
+
+// Named glyphs of \(xx and \[xx], dispatched like requests
+static char const* glyph(String_View name)
+{
+	switch (macro_code(name)) {
+	case Macro2('e','m'): return "—";
+	case Macro2('e','n'): return "–";
+	case Macro2('h','y'): return "-";
+	case Macro2('m','i'): return "−";
+	case Macro2('l','q'): return "“";
+	case Macro2('r','q'): return "”";
+	case Macro2('o','q'): return "‘";
+	case Macro2('c','q'): return "’";
+	case Macro2('a','q'): return "'";
+	case Macro2('d','q'): return "&quot;";
+	case Macro2('F','o'): return "«";
+	case Macro2('F','c'): return "»";
+	case Macro2('f','o'): return "‹";
+	case Macro2('f','c'): return "›";
+	case Macro2('b','u'): return "•";
+	case Macro2('c','o'): return "©";
+	case Macro2('r','g'): return "®";
+	case Macro2('t','m'): return "™";
+	case Macro2('d','e'): return "°";
+	case Macro2('d','g'): return "†";
+	case Macro2('d','d'): return "‡";
+	case Macro2('p','s'): return "¶";
+	case Macro2('s','c'): return "§";
+	case Macro2('+','-'): return "±";
+	case Macro2('m','u'): return "×";
+	case Macro2('d','i'): return "÷";
+	case Macro2('<','='): return "≤";
+	case Macro2('>','='): return "≥";
+	case Macro2('!','='): return "≠";
+	case Macro2('-','>'): return "→";
+	case Macro2('<','-'): return "←";
+	case Macro2('r','A'): return "⇒";
+	case Macro2('l','A'): return "⇐";
+	case Macro2('u','a'): return "↑";
+	case Macro2('d','a'): return "↓";
+	case Macro2('i','f'): return "∞";
+	case Macro2('e','s'): return "∅";
+	case Macro2('s','s'): return "ß";
+	case Macro2('f','m'): return "′";
+	case Macro2('s','d'): return "″";
+	case Macro2('s','q'): return "□";
+	case Macro2('c','i'): return "○";
+	case Macro2('g','a'): return "`";
+	case Macro2('a','a'): return "´";
+	case Macro2('t','i'): case Macro2('a','~'): return "~";
+	case Macro2('h','a'): case Macro2('a','^'): return "^";
+	case Macro2('r','s'): return "\\";
+	case Macro2('s','l'): return "/";
+	case Macro2('b','a'): case Macro2('b','r'): return "|";
+	case Macro2('u','l'): return "_";
+	case Macro2('p','l'): return "+";
+	case Macro2('e','q'): return "=";
+	case Macro2('l','B'): return "[";
+	case Macro2('r','B'): return "]";
+	case Macro2('l','C'): return "{";
+	case Macro2('r','C'): return "}";
+	case Macro2('l','a'): return "&lt;";
+	case Macro2('r','a'): return "&gt;";
+	case Macro2('a','t'): return "@";
+	case Macro2('s','h'): return "#";
+	case Macro2('D','o'): return "$";
+	case Macro2('t','f'): return "∴";
+	}
+	return NULL;
+}
+
+static void scratch_append(Parser *parser, char const* data, size_t count)
+{
+	Msg_Buffer *scratch = &parser->scratch;
+	if (count == 0) {
+		return;
+	}
+	if (scratch->count + count > scratch->capacity) {
+		size_t capacity = scratch->capacity ? scratch->capacity : 256;
+		while (capacity < scratch->count + count) {
+			capacity *= 2;
+		}
+		scratch->data = realloc(scratch->data, capacity);
+		assert(scratch->data);
+		scratch->capacity = capacity;
+	}
+	memcpy(scratch->data + scratch->count, data, count);
+	scratch->count += count;
+}
+
+static void scratch_cstr(Parser *parser, char const* cstr)
+{
+	scratch_append(parser, cstr, strlen(cstr));
+}
+
+// Characters that need translation, lines without them are used as they are
+static bool const special_characters[256] = { ['\\'] = true, ['<'] = true, ['>'] = true, ['&'] = true };
+
+static bool is_special(char c)
+{
+	return special_characters[(unsigned char)c];
+}
+
+// Returns length of prefix of text that needs no translation
+static size_t plain_prefix(String_View text)
+{
+	size_t i = 0;
+	while (i < text.count && !is_special(text.data[i])) {
+		++i;
+	}
+	return i;
+}
+
+// Deepest nesting of strings interpolated into each other
+#define Msg_Interpolation_Depth 16
+
+// Appends HTML for roff text to scratch: escapes become characters or tags of fonts,
+// strings (\*) and registers (\n) are interpolated with their current values.
+// Returns font left open by text, so interpolated strings continue in it.
+static char const* translate_into(Parser *parser, String_View text, char const* font, size_t depth)
+{
+	size_t start = 0;
+	for (size_t i = 0; i < text.count; ++i) {
+		char c = text.data[i];
+		if (!is_special(c)) {
+			continue;
+		}
+		scratch_append(parser, text.data + start, i - start);
+		start = i + 1;
+
+		switch (c) {
+		break; case '<': scratch_cstr(parser, "&lt;"); continue;
+		break; case '>': scratch_cstr(parser, "&gt;"); continue;
+		break; case '&': scratch_cstr(parser, "&amp;"); continue;
+		}
+
+		if (i + 1 == text.count) {
+			// Backslash at the end joins lines
+			break;
+		}
+		String_View rest = sv_from_parts(text.data + i + 2, text.count - i - 2);
+		char escape = text.data[i + 1];
+		switch (escape) {
+		break; case '\\': case 'e': case 'E': scratch_cstr(parser, "\\");
+		break; case '-': scratch_cstr(parser, "-");
+		break; case '.': scratch_cstr(parser, ".");
+		break; case '\'': scratch_cstr(parser, "'");
+		break; case '`': scratch_cstr(parser, "`");
+		break; case ' ': case '~': case '0': scratch_cstr(parser, "\u00a0");
+		break; case '&': case ')': case '%': case ':': case 'c': case '/': case ',': case '^': case '|': case 'd': case 'u': case '{': case '}':
+		break; case '\n':
+			// Escaped line break joins lines
+		break; case '"': case '#': {
+			// Comment takes rest of line
+			char const* newline = memchr(rest.data, '\n', rest.count);
+			rest = newline ? sv_from_parts(newline, rest.data + rest.count - newline) : SV_NULL;
+		}
+		break; case '(': case '[': {
+			rest = sv_from_parts(text.data + i + 1, text.count - i - 1);
+			String_View name = escape_name(&rest);
+			char const* g = glyph(name);
+			if (g) {
+				scratch_cstr(parser, g);
+			} else if (escape == '[' && name.count >= 5 && name.data[0] == 'u') {
+				// Unicode character \[uXXXX]
+				char hex[8] = {0};
+				memcpy(hex, name.data + 1, name.count - 1 < 7 ? name.count - 1 : 7);
+				unsigned long code = strtoul(hex, NULL, 16);
+				char utf8[4];
+				size_t n = code < 0x80 ? 1 : code < 0x800 ? 2 : code < 0x10000 ? 3 : 4;
+				static unsigned char const lead[] = { 0, 0, 0xc0, 0xe0, 0xf0 };
+				for (size_t k = n - 1; k > 0; --k) {
+					utf8[k] = 0x80 | (code & 0x3f);
+					code >>= 6;
+				}
+				utf8[0] = lead[n] | code;
+				scratch_append(parser, utf8, n);
+			}
+		}
+		break; case 'f': {
+			String_View name = escape_name(&rest);
+			char const* next = NULL;
+			if (sv_eq(name, SV("B")) || sv_eq(name, SV("3")) || sv_eq(name, SV("BI")) || sv_eq(name, SV("CB")) || sv_eq(name, SV("4"))) {
+				next = "b";
+			} else if (sv_eq(name, SV("I")) || sv_eq(name, SV("2")) || sv_eq(name, SV("CI"))) {
+				next = "i";
+			}
+			if (font != next) {
+				if (font) {
+					scratch_cstr(parser, "</"); scratch_cstr(parser, font); scratch_cstr(parser, ">");
+				}
+				if (next) {
+					scratch_cstr(parser, "<"); scratch_cstr(parser, next); scratch_cstr(parser, ">");
+				}
+				font = next;
+			}
+		}
+		break; case '*': {
+			if (rest.count && rest.data[0] == '*') {
+				sv_chop_left(&rest, 1);
+			}
+			Symbol const* symbol = intern(parser, escape_name(&rest), false);
+			if (symbol && symbol->has_string && depth < Msg_Interpolation_Depth) {
+				font = translate_into(parser, symbol->string, font, depth + 1);
+			}
+		}
+		break; case 'n': {
+			if (rest.count && (rest.data[0] == '+' || rest.data[0] == '-')) {
+				sv_chop_left(&rest, 1);
+			}
+			char number[24];
+			scratch_append(parser, number, snprintf(number, sizeof(number), "%ld", register_value(parser, escape_name(&rest))));
+		}
+		break; case 's':
+			// Size changes are ignored, \s+2, \s(12 and \s[12] alike
+			if (rest.count && (rest.data[0] == '+' || rest.data[0] == '-')) {
+				sv_chop_left(&rest, 1);
+			}
+			if (rest.count && (rest.data[0] == '(' || rest.data[0] == '[')) {
+				escape_name(&rest);
+			} else {
+				while (rest.count && isdigit((unsigned char)rest.data[0])) {
+					sv_chop_left(&rest, 1);
+				}
+			}
+		break; case 'm': case 'M': case 'F': case 'g': case 'k': case 'V': case 'Y':
+			escape_name(&rest);
+		break; case 'h': case 'v': case 'w': case 'o': case 'Z': case 'X': case 'D': case 'l': case 'L': case 'b': case 'N': case 'x': case 'A': case 'B': case 'R': case 'C':
+			// Arguments are quoted with delimiter, like \h'1n'
+			if (rest.count) {
+				char const* close = memchr(rest.data + 1, rest.data[0], rest.count - 1);
+				sv_chop_left(&rest, close ? close - rest.data + 1 : rest.count);
+			}
+		break; case 'z':
+			sv_chop_left(&rest, rest.count ? 1 : 0);
+		break; case '<': scratch_cstr(parser, "&lt;");
+		break; case '>': scratch_cstr(parser, "&gt;");
+		break; default:
+			// Unknown escape stands for the character itself
+			scratch_append(parser, &escape, 1);
+		}
+
+		i = rest.data ? (size_t)(rest.data - text.data) - 1 : text.count;
+		start = i + 1;
+	}
+	if (start < text.count) {
+		scratch_append(parser, text.data + start, text.count - start);
+	}
+	return font;
+}
+
+// Translates text into HTML stored in page, see translate_into
+static String_View translate(Parser *parser, String_View text)
+{
+	size_t plain = plain_prefix(text);
+	if (plain == text.count) {
+		return text;
+	}
+	parser->scratch.count = 0;
+	scratch_append(parser, text.data, plain);
+	char const* font = translate_into(parser, sv_from_parts(text.data + plain, text.count - plain), NULL, 0);
+	if (font) {
+		scratch_cstr(parser, "</"); scratch_cstr(parser, font); scratch_cstr(parser, ">");
+	}
+	return page_store(parser, sv_from_parts(parser->scratch.data, parser->scratch.count));
+}
+
+// Translates every argument on its own, so tags of fonts don't cross arguments.
+// Arguments are joined back with single spaces, quoted ones stay quoted.
+static String_View translate_arguments(Parser *parser, String_View args)
+{
+	if (plain_prefix(args) == args.count) {
+		return args;
+	}
+	parser->scratch.count = 0;
+	for (String_View arg;;) {
+		char const* before = args.data;
+		if (!next_argument(&args, &arg)) {
+			break;
+		}
+		bool quoted = arg.data > before && arg.data[-1] == '"';
+		if (parser->scratch.count > 0) {
+			scratch_cstr(parser, " ");
+		}
+		if (quoted) {
+			scratch_cstr(parser, "\"");
+		}
+		char const* font = translate_into(parser, arg, NULL, 0);
+		if (font) {
+			scratch_cstr(parser, "</"); scratch_cstr(parser, font); scratch_cstr(parser, ">");
+		}
+		if (quoted) {
+			scratch_cstr(parser, "\"");
+		}
+	}
+	return page_store(parser, sv_from_parts(parser->scratch.data, parser->scratch.count));
+}
+
+static bool parse_line(Parser *parser, String_View line);
+
+// Troff conditions: n (true, output is not typeset), t, e, o and v (false), c,
+// d (string or macro is defined), r (register is defined), 'a'b' (strings are equal)
+// and numeric expressions, true when positive. Any of them may be negated with !.
+static bool eval_condition(Parser *parser, String_View *args)
+{
+	bool negate = args->count && args->data[0] == '!';
+	if (negate) {
+		sv_chop_left(args, 1);
+	}
+	if (args->count == 0) {
+		return negate;
+	}
+
+	bool result = false;
+	char c = args->data[0];
+	if (c == 'n' || c == 't' || c == 'e' || c == 'o' || c == 'v') {
+		result = c == 'n';
+		sv_chop_left(args, 1);
+	} else if (c == 'd' || c == 'r' || c == 'c') {
+		sv_chop_left(args, 1);
+		*args = sv_trim_left(*args);
+		String_View name = sv_take_left_while(*args, msg_is_name);
+		sv_chop_left(args, name.count);
+		Symbol const* symbol = intern(parser, name, false);
+		result = c == 'd' ? (symbol && symbol->has_string) || find_macro(parser, name, false)
+			: c == 'r' ? symbol && symbol->has_number
+			: false;
+	} else if (!isdigit((unsigned char)c) && !strchr("(+-\\|", c)) {
+		// Both strings are compared after interpolation
+		char const* first = memchr(args->data + 1, c, args->count - 1);
+		char const* second = first ? memchr(first + 1, c, args->data + args->count - first - 1) : NULL;
+		if (!second) {
+			*args = SV_NULL;
+			return negate;
+		}
+		parser->scratch.count = 0;
+		translate_into(parser, sv_from_parts(args->data + 1, first - args->data - 1), NULL, 0);
+		size_t split = parser->scratch.count;
+		translate_into(parser, sv_from_parts(first + 1, second - first - 1), NULL, 0);
+		result = parser->scratch.count == 2 * split && memcmp(parser->scratch.data, parser->scratch.data + split, split) == 0;
+		sv_chop_left(args, second - args->data + 1);
+	} else {
+		result = eval_expression(parser, args) > 0;
+	}
+	return negate ? !result : result;
+}
+
+// Counts \\{ minus \\} in line
+static long count_blocks(String_View line)
+{
+	long blocks = 0;
+	for (size_t i = 0; i + 1 < line.count; ++i) {
+		if (line.data[i] == '\\') {
+			blocks += line.data[i + 1] == '{';
+			blocks -= line.data[i + 1] == '}';
+			i += 1;
+		}
+	}
+	return blocks;
+}
+
+// Parses body of .if, .ie or .el, which is either rest of line or \\{ block spanning lines until \\}
+static bool parse_conditional(Parser *parser, bool condition, String_View body)
+{
+	body = sv_trim_left(body);
+	bool block = sv_starts_with(body, SV("\\{"));
+	if (!condition) {
+		if (block) {
+			parser->skipping = count_blocks(body);
+		}
+		return true;
+	}
+	if (block) {
+		sv_chop_left(&body, 2);
+		// Block usually starts on the next line after \{\ with escaped line break
+		if (sv_ends_with(body, SV("\\")) && !sv_ends_with(body, SV("\\\\"))) {
+			body.count -= 1;
+		}
+		body = sv_trim_left(body);
+		if (body.count == 0) {
+			return true;
+		}
+	}
+	return parse_line(parser, body);
+}
+
+// Expands tokens of macro with given arguments into buffer owned by page and parses resulting lines
+static bool expand_macro(Parser *parser, Macro const* macro, String_View args)
+{
+	if (parser->depth == Msg_Macro_Depth) {
+		msg_report(parser->config, Msg_Error, parser->page.path, parser->line_number, 1,
+			"macro " SV_Fmt " is nested deeper than %d calls", SV_Arg(macro->name), Msg_Macro_Depth);
+		return false;
+	}
+
+	String_View arguments[9] = {0};
+	size_t arguments_count = 0, all_size = 0;
+	while (arguments_count < 9 && next_argument(&args, &arguments[arguments_count])) {
+		all_size += arguments[arguments_count++].count + 1;
+	}
+
+	size_t size = 0;
+	for (size_t i = 0; i < macro->tokens_count; ++i) {
+		Macro_Token const* token = &macro->tokens[i];
+		switch (token->kind) {
+		break; case Macro_Literal:       size += token->text.count;
+		break; case Macro_All_Arguments: size += all_size;
+		break; case Macro_Line_End:      size += 1;
+		break; default:                  size += arguments[token->kind - 1].count;
+		}
+	}
+
+	char *buffer = page_alloc(parser, size), *end = buffer;
+
+	for (size_t i = 0; i < macro->tokens_count; ++i) {
+		Macro_Token const* token = &macro->tokens[i];
+		switch (token->kind) {
+		break; case Macro_Literal:
+			memcpy(end, token->text.data, token->text.count);
+			end += token->text.count;
+		break; case Macro_All_Arguments:
+			for (size_t j = 0; j < arguments_count; ++j) {
+				if (j > 0) {
+					*end++ = ' ';
+				}
+				memcpy(end, arguments[j].data, arguments[j].count);
+				end += arguments[j].count;
+			}
+		break; case Macro_Line_End:
+			*end++ = '\n';
+		break; default:
+			// Missing arguments are empty
+			if (arguments[token->kind - 1].count) {
+				memcpy(end, arguments[token->kind - 1].data, arguments[token->kind - 1].count);
+				end += arguments[token->kind - 1].count;
+			}
+		}
+	}
+
+	// Lines of expansion are reported at line of call
+	String_View expansion = sv_from_parts(buffer, end - buffer);
+	parser->depth += 1;
+	bool ok = true;
+	while (ok && expansion.count > 0) {
+		ok = parse_line(parser, sv_chop_by_delim(&expansion, '\n'));
+	}
+	parser->depth -= 1;
+	return ok;
+}
+
+// Translates escapes in value of command, see translate
+static String_View translate_value(Parser *parser, int type, String_View value)
+{
+	switch (type) {
+	case Subsection: case Text:
+		return translate(parser, value);
+	case Indented_Paragraph: case Name: case Description: case Inline: case List_Item:
+	case Bold: case Italic: case Bold_Roman: case Italic_Roman: case Roman_Bold: case Roman_Italic: case Bold_Italic: case Italic_Bold:
+		return translate_arguments(parser, value);
+	}
+	// Paths, list options and commands without values are used as they are
+	return value;
+}
+
+// Text line holding only end of \{ block
+static bool is_block_end(String_View line)
+{
+	size_t i = 0;
+	while (i < line.count && (line.data[i] == ' ' || line.data[i] == '\t')) {
+		++i;
+	}
+	if (i + 1 >= line.count || line.data[i] != '\\' || line.data[i + 1] != '}') {
+		return false;
+	}
+	while (i + 1 < line.count && line.data[i] == '\\' && line.data[i + 1] == '}') {
+		i += 2;
+	}
+	return sv_trim(sv_from_parts(line.data + i, line.count - i)).count == 0;
+}
+
+// Makes sure that there is section for command of given type. Text is only allowed
+// after .SH, but fragments and .so before it get section without name.
+static bool has_section(Parser *parser, int type)
+{
+	Page *page = &parser->page;
+	if (page->sections_count == 0 && (parser->fragment || type == Include)) {
+		Push(*page, sections);
+		Back(*page, sections)->name = SV_NULL;
+	}
+
+	if (page->sections_count == 0 || (!Back(*page, sections)->name.data && !parser->fragment && type != Include)) {
+		msg_report(parser->config, Msg_Error, page->path, parser->line_number, 1, "trying to add text without specifing section header .SH");
+		return false;
+	}
+	return true;
+}
+
+// Adds collected text lines as single command, translated all at once
+static bool flush_lines(Parser *parser)
+{
+	if (!parser->lines.data) {
+		return true;
+	}
+	// Diagnostics point to the first collected line, not to the line that ended them
+	size_t line_number = parser->line_number;
+	parser->line_number = parser->lines_line_number;
+	String_View value = translate(parser, parser->lines);
+	parser->lines = SV_NULL;
+	bool ok = true;
+	int type = parser->no_fill ? Preformatted : Text;
+	// Lines of escapes that don't print anything, like \&, add nothing to page
+	if (value.count > 0 || parser->no_fill) {
+		ok = has_section(parser, type);
+		if (ok) {
+			push_command(&parser->page, type, value);
+			parser->tag_next = false;
+		}
+	}
+	parser->line_number = line_number;
+	return ok;
+}
+
+// Parses single line, either from source or from expansion of macro
+static bool parse_line(Parser *parser, String_View line)
+{
+	Msg_Config const* config = parser->config;
+	Page *page = &parser->page;
+
+	if (parser->defining) {
+		if (is_control_line(line) && sv_eq(sv_trim(sv_from_parts(line.data + 1, line.count - 1)), parser->terminator)) {
+			parser->defining = NULL;
+		} else {
+			define_line(parser->defining, line);
+		}
+		return true;
+	}
+
+	// Inside of \{ block after false condition
+	if (parser->skipping > 0) {
+		parser->skipping += count_blocks(line);
+		if (parser->skipping < 0) {
+			parser->skipping = 0;
+		}
+		return true;
+	}
+
+	int type = Text;
+	String_View value = line;
+	bool display_line = false;
+
+	if (is_control_line(line)) {
+		parser->pending = Pending_None;
+		if (!flush_lines(parser)) {
+			return false;
+		}
+		String_View name, args;
+		// Comments, empty requests and ends of \{ blocks produce nothing
+		if (is_block_end(sv_from_parts(line.data + 1, line.count - 1)) || !split_request(line, &name, &args)) {
+			return true;
+		}
+
+		// Macros defined by page take precedence over built in ones
+		Macro const* macro = find_macro(parser, name, false);
+		if (macro) {
+			return expand_macro(parser, macro, args);
+		}
+
+		type = parser->dialect == Dialect_Mdoc ? mdoc_request(macro_code(name)) : man_request(macro_code(name));
+		value = args;
+
+		switch (type) {
+		case Request_Title: {
+			bool escape = false;
+			int cursor = 0, start = 0;
+
+			line = args;
+			for (int i = start; i < line.count && cursor < Title_Fields; ++i) {
+				if ((!escape && line.data[i] == ' ') || i+1 == line.count) {
+					page->title[cursor++] = sv_trim((String_View) {
+						.data  = line.data + start,
+						.count = i - start + 1,
+					});
+					start = i;
+					continue;
+				}
+				if (line.data[i] == '\\') {
+					escape = true;
+					continue;
+				}
+				escape = false;
+			}
+			return true;
+		}
+
+		case Request_Date:
+			if (sv_starts_with(args, SV("$Mdocdate:"))) {
+				sv_chop_left(&args, 10);
+				args = sv_trim(args);
+				if (args.count > 0 && args.data[args.count - 1] == '$') {
+					args.count -= 1;
+				}
+			}
+			page->title[2] = sv_trim(args);
+			return true;
+
+		case Request_Document:
+			for (int i = 0; i < 2 && next_argument(&args, &page->title[i]); ++i) {}
+			return true;
+
+		case Request_System:
+			page->title[3] = args;
+			return true;
+
+		case Request_Section:
+			parser->no_fill = false;
+			Push(*page, sections);
+			Back(*page, sections)->name = translate(parser, args);
+			// Heading without arguments is on the next line
+			parser->pending = args.count ? Pending_None : Pending_Section;
+			return true;
+
+		case Request_Define: case Request_Append: {
+			String_View macro_name;
+			if (!next_argument(&args, &macro_name)) {
+				msg_report(config, Msg_Warning, page->path, parser->line_number, 1, "macro definition without name");
+				macro_name = SV("");
+			}
+			parser->defining = find_macro(parser, macro_name, true);
+			if (type == Request_Define) {
+				parser->defining->tokens_count = 0;
+			}
+			// Body ends with .. or with request named by second argument
+			if (!next_argument(&args, &parser->terminator)) {
+				parser->terminator = SV(".");
+			}
+			return true;
+		}
+
+		case Request_String: case Request_String_Append: {
+			String_View symbol_name;
+			if (!next_argument(&args, &symbol_name)) {
+				return true;
+			}
+			// Leading quote keeps leading spaces and isn't part of string
+			if (args.count && args.data[0] == '"') {
+				sv_chop_left(&args, 1);
+			}
+			Symbol *symbol = intern(parser, symbol_name, true);
+			if (type == Request_String_Append && symbol->has_string && symbol->string.count) {
+				char *data = page_alloc(parser, symbol->string.count + args.count);
+				memcpy(data, symbol->string.data, symbol->string.count);
+				memcpy(data + symbol->string.count, args.data, args.count);
+				args = sv_from_parts(data, symbol->string.count + args.count);
+			}
+			symbol->string = args;
+			symbol->has_string = true;
+			return true;
+		}
+
+		case Request_Register: {
+			String_View symbol_name = sv_take_left_while(args, msg_is_name);
+			sv_chop_left(&args, symbol_name.count);
+			args = sv_trim_left(args);
+			Symbol *symbol = intern(parser, symbol_name, true);
+			// Value with sign changes current one
+			char sign = args.count ? args.data[0] : 0;
+			if (sign == '+' || sign == '-') {
+				sv_chop_left(&args, 1);
+			}
+			long number = eval_expression(parser, &args);
+			symbol->number = sign == '+' ? symbol->number + number : sign == '-' ? symbol->number - number : number;
+			symbol->has_number = true;
+			return true;
+		}
+
+		case Request_Remove:
+			for (String_View arg; next_argument(&args, &arg);) {
+				Symbol *symbol = intern(parser, arg, false);
+				if (symbol) {
+					symbol->has_string = symbol->has_string && name.data[1] == 'r';
+					symbol->has_number = symbol->has_number && name.data[1] == 'm';
+				}
+			}
+			return true;
+
+		case Request_If:
+			return parse_conditional(parser, eval_condition(parser, &args), args);
+
+		case Request_If_Else: {
+			bool condition = eval_condition(parser, &args);
+			parser->conditions = parser->conditions << 1 | !condition;
+			return parse_conditional(parser, condition, args);
+		}
+
+		case Request_Else: {
+			bool condition = parser->conditions & 1;
+			parser->conditions >>= 1;
+			return parse_conditional(parser, condition, args);
+		}
+
+		case Request_Ignored:
+			return true;
+
+		case Request_Unknown:
+			// Arguments are left out, so repeated uses of the same command have the same message
+			name = sv_chop_by_delim(&line, ' ');
+			msg_report(config, Msg_Warning, page->path, parser->line_number, 1, "unrecognized command: " SV_Fmt, SV_Arg(name));
+			return true;
+
+		case Request_Display: {
+			bool literal = false;
+			for (String_View arg; next_argument(&args, &arg);) {
+				literal = literal || sv_eq(arg, SV("-literal")) || sv_eq(arg, SV("-unfilled"));
+			}
+			parser->displays = parser->displays << 1 | literal;
+			type = literal ? No_Fill : Indent;
+			value = SV_NULL;
+		} break;
+
+		case Request_Display_End:
+			type = parser->displays & 1 ? Fill : Unindent;
+			parser->displays >>= 1;
+			value = SV_NULL;
+			break;
+
+		case Request_Display_Line:
+			type = Inline;
+			display_line = true;
+			break;
+
+		case Inline:
+			// Line starts with callable macro, which is kept in value
+			value = sv_from_parts(name.data, line.data + line.count - name.data);
+			break;
+
+		case Name:
+			// Name of page is remembered from first .Nm and repeated by .Nm without arguments
+			if (!parser->name_of_page.count) {
+				String_View rest = args;
+				next_argument(&rest, &parser->name_of_page);
+			} else if (!args.count) {
+				value = parser->name_of_page;
+			}
+			break;
+		}
+
+		// Headings and font changes without arguments apply to the next line
+		if (args.count == 0 && (type == Subsection || (type >= Bold && type <= Italic_Bold))) {
+			parser->pending = Pending_Command;
+		}
+		if (type == No_Fill || type == Fill) {
+			parser->no_fill = type == No_Fill;
+		}
+		value = translate_value(parser, type, value);
+	} else if (is_block_end(line)) {
+		// Closing of \{ block taken by true condition
+		return true;
+	} else if (parser->pending == Pending_Section) {
+		Back(*page, sections)->name = translate(parser, line);
+		parser->pending = Pending_None;
+		return true;
+	} else if (parser->pending == Pending_Command) {
+		Command *command = Back(*Back(*page, sections), commands);
+		command->value = translate_value(parser, command->type, line);
+		parser->pending = Pending_None;
+		return true;
+	} else if (!parser->no_fill && sv_trim(line).count == 0) {
+		// Blank line separates paragraphs, ones at start of section or before it add nothing
+		if (!flush_lines(parser)) {
+			return false;
+		}
+		if (page->sections_count == 0 || Back(*page, sections)->commands_count == 0) {
+			return true;
+		}
+		type = Paragraph;
+		value = SV_NULL;
+	} else {
+		// Line that directly follows collected ones extends their range
+		String_View *range = &parser->lines;
+		if (range->data && line.data == range->data + range->count + 1 && range->data[range->count] == '\n') {
+			range->count += line.count + 1;
+			return true;
+		}
+		if (!flush_lines(parser)) {
+			return false;
+		}
+		*range = line;
+		parser->lines_line_number = parser->line_number;
+		return !parser->tag_next || flush_lines(parser);
+	}
+
+	if (!has_section(parser, type)) {
+		return false;
+	}
+
+	// Blank lines before .PP or after another blank line don't start another paragraph
+	Section *section = Back(*page, sections);
+	if (type == Paragraph && section->commands_count && Back(*section, commands)->type == Paragraph) {
+		return true;
+	}
+	parser->tag_next = type == Tagged_Paragraph;
+
+	if (display_line) {
+		push_command(page, Indent, SV_NULL);
+	}
+	push_command(page, type, value);
+	if (display_line) {
+		push_command(page, Unindent, SV_NULL);
+	}
+	return true;
+}
+
+// Parses lines of src into page, counting lines from 1. Title fields that
+// weren't set by .TH stay empty, so parts of page can be merged later.
+// Commands of fragment (included file) before first .SH go to section without name,
+// pages may only have .so there, which is resolved by expand_includes.
+static bool parse_lines(Msg_Config const* config, String_View src, Dialect dialect, bool fragment, Page *result, size_t *lines)
+{
+	Parser parser = {
+		.config = config,
+		.dialect = dialect,
+		.fragment = fragment,
+		.page = { .path = result->path, .source = result->source },
+	};
+
+	bool ok = true;
+	for (parser.line_number = 1; ok && src.count != 0; ++parser.line_number) {
+		char const* newline = memchr(src.data, '\n', src.count);
+		size_t count = newline ? (size_t)(newline - src.data) : src.count;
+		ok = parse_line(&parser, sv_from_parts(src.data, count));
+		sv_chop_left(&src, count + (newline != NULL));
+	}
+	ok = ok && flush_lines(&parser);
+	free_macros(&parser);
+	free(parser.symbols);
+	free(parser.scratch.data);
+
+	if (!ok) {
+		free_page(&parser.page);
+		return false;
+	}
+	*lines = parser.line_number - 1;
+	*result = parser.page;
+	return true;
+}
+
+// Smallest part of page worth its own thread
+#define Msg_Min_Part_Size (1 << 20)
+
+// Part of page parsed by one thread. Diagnostics are collected and reported
+// after all threads finish, in order of parts, with line numbers made absolute.
+typedef struct page_part
+{
+	Msg_Config config;
+	String_View src;
+	Page page;
+	size_t lines;
+	bool ok;
+
+	Msg_Diagnostic *diagnostics;
+	size_t diagnostics_count;
+	size_t diagnostics_capacity;
+} Page_Part;
+
+static void collect_part_diagnostic(void *data, Msg_Diagnostic const* diagnostic)
+{
+	Page_Part *part = data;
+	char *message = malloc(diagnostic->message.count);
+	assert(message);
+	memcpy(message, diagnostic->message.data, diagnostic->message.count);
+
+	Push(*part, diagnostics);
+	*Back(*part, diagnostics) = *diagnostic;
+	Back(*part, diagnostics)->message = sv_from_parts(message, diagnostic->message.count);
+}
+
+static void* parse_part(void *data)
+{
+	Page_Part *part = data;
+	part->ok = parse_lines(&part->config, part->src, Dialect_Man, false, &part->page, &part->lines);
+	return NULL;
+}
+
+// Number of parts that page of given size is split into
+static size_t parts_for(Msg_Config const* config, size_t size)
+{
+	size_t parts = size / Msg_Min_Part_Size;
+	return config->jobs < parts ? config->jobs : parts;
+}
+
+// Returns start of first line beginning with .SH at or after from, or end of src.
+static char const* next_section_start(String_View src, char const* from)
+{
+	char const* end = src.data + src.count;
+	if (from > src.data && from[-1] != '\n') {
+		char const* newline = memchr(from, '\n', end - from);
+		from = newline ? newline + 1 : end;
+	}
+	while (from < end) {
+		// Only lines that parser reads as .SH request can start part
+		if (end - from >= 3 && memcmp(from, ".SH", 3) == 0 && (end - from == 3 || strchr(" \t\n", from[3]))) {
+			return from;
+		}
+		char const* newline = memchr(from, '\n', end - from);
+		from = newline ? newline + 1 : end;
+	}
+	return end;
+}
+
+// Requests whose effect lasts until later lines, which other parts of page wouldn't see:
+// definitions of macros, strings and registers, and conditions that may span lines
+static bool has_state(String_View src)
+{
+	static char const requests[][3] = { "de", "am", "ds", "as", "nr", "if", "ie", "el" };
+	for (char const* p = src.data, *end = src.data + src.count; p < end;) {
+		if (end - p >= 3 && (p[0] == '.' || p[0] == '\'')) {
+			for (size_t i = 0; i < sizeof(requests) / sizeof(*requests); ++i) {
+				if (memcmp(p + 1, requests[i], 2) == 0) {
+					return true;
+				}
+			}
+		}
+		char const* newline = memchr(p, '\n', end - p);
+		p = newline ? newline + 1 : end;
+	}
+	return false;
+}
+
+// Splits src at .SH lines into parts of similar size and parses them in parallel.
+// Every part except first starts with .SH, so text outside of section can only
+// be found in first part, as in serial parsing.
+static bool parse_page_parallel(Msg_Config const* config, Page *page, size_t parts_count)
+{
+	String_View src = page->source;
+	Page_Part *parts = calloc(parts_count, sizeof(*parts));
+	pthread_t *threads = calloc(parts_count, sizeof(*threads));
+	assert(parts && threads);
+
+	char const* start = src.data;
+	size_t count = 0;
+	for (; count < parts_count && start < src.data + src.count; ++count) {
+		char const* target = src.data + src.count / parts_count * (count + 1);
+		char const* end = count + 1 == parts_count ? src.data + src.count
+			: next_section_start(src, target > start ? target : start + 1);
+		parts[count] = (Page_Part) { .config = *config, .src = sv_from_parts(start, end - start) };
+		parts[count].page = (Page) { .path = page->path, .source = src };
+		parts[count].config.diagnostic = collect_part_diagnostic;
+		parts[count].config.diagnostic_data = &parts[count];
+		start = end;
+	}
+
+	for (size_t i = 1; i < count; ++i) {
+		int error = pthread_create(&threads[i], NULL, parse_part, &parts[i]);
+		assert(error == 0);
+	}
+	parse_part(&parts[0]);
+	for (size_t i = 1; i < count; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+
+	bool ok = true;
+	size_t line_offset = 0, sections_count = 0;
+	for (size_t i = 0; i < count; ++i) {
+		Page_Part *part = &parts[i];
+		for (size_t j = 0; j < part->diagnostics_count; ++j) {
+			Msg_Diagnostic *diagnostic = &part->diagnostics[j];
+			// Diagnostics of included files have lines of their own
+			if (diagnostic->path == page->path) {
+				diagnostic->line += line_offset;
+			}
+			if (ok && config->diagnostic) {
+				config->diagnostic(config->diagnostic_data, diagnostic);
+			}
+			free((char*)diagnostic->message.data);
+		}
+		free(part->diagnostics);
+		line_offset += part->lines;
+		sections_count += part->page.sections_count;
+		ok = ok && part->ok;
+	}
+
+	if (ok) {
+		page->sections = malloc(sections_count * sizeof(*page->sections));
+		assert(page->sections || sections_count == 0);
+		page->sections_count = page->sections_capacity = sections_count;
+	}
+
+	for (size_t i = 0, offset = 0; i < count; ++i) {
+		Page *part = &parts[i].page;
+		if (ok) {
+			memcpy(page->sections + offset, part->sections, part->sections_count * sizeof(*part->sections));
+			offset += part->sections_count;
+			// Fields of title are overwritten by the last .TH that set them
+			for (size_t j = 0; j < Title_Fields; ++j) {
+				if (part->title[j].data) {
+					page->title[j] = part->title[j];
+				}
+			}
+			free(part->sections);
+			// Text generated while parsing part is kept as long as page that refers to it
+			for (size_t j = 0; j < part->buffers_count; ++j) {
+				Push(*page, buffers);
+				*Back(*page, buffers) = part->buffers[j];
+			}
+			free(part->buffers);
+		} else {
+			free_page(part);
+		}
+	}
+
+	free(threads);
+	free(parts);
+	return ok;
+}
+
+// Included file, parsed once per process as fragment with its own .so left unresolved,
+// so loading of one include never waits for another one
+typedef struct included_file
+{
+	char *path; // as first resolved, for diagnostics
+	dev_t device;
+	ino_t inode;
+	struct timespec mtime;
+	Page page;
+	bool ok;
+	// Why file couldn't be read, reported by every page that includes it
+	char *error;
+	bool loading;
+	struct included_file *next;
+} Included_File;
+
+#define Msg_Include_Buckets 1024
+// Deepest chain of nested includes
+#define Msg_Include_Depth 16
+
+// Process wide cache of includes by file, newest first, so every spelling of path
+// like man1/../man7/x and man3/../man7/x finds the same entry. Entries are never freed,
+// because pages rendered at the same time may point into them.
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t loaded;
+	Included_File *buckets[Msg_Include_Buckets];
+} includes = { .lock = PTHREAD_MUTEX_INITIALIZER, .loaded = PTHREAD_COND_INITIALIZER };
+
+// Files that are being included, innermost first, for detection of cycles
+typedef struct include_chain
+{
+	dev_t device;
+	ino_t inode;
+	struct include_chain const* next;
+} Include_Chain;
+
+static bool has_includes(Page const* page)
+{
+	for (size_t i = 0; i < page->sections_count; ++i) {
+		for (size_t j = 0; j < page->sections[i].commands_count; ++j) {
+			if (page->sections[i].commands[j].type == Include) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static size_t line_of(String_View source, char const* at)
+{
+	size_t line = 1;
+	for (char const* p = source.data; p < at && p < source.data + source.count; ++p) {
+		line += *p == '\n';
+	}
+	return line;
+}
+
+// Names in .so are relative to root of manpath (like man3/other.3), directory of page
+// or current directory, compressed files are found by their suffix.
+static bool resolve_include(char const* page_path, String_View name, char *path, size_t size, struct stat *st)
+{
+	char const* slash = strrchr(page_path, '/');
+	int page_dir = slash ? slash - page_path : 0;
+	char const* parent = slash ? "/.." : "..";
+	if (!slash) {
+		page_path = ".";
+		page_dir = 1;
+	}
+
+	static char const* const suffixes[] = { "", ".gz", ".xz" };
+	for (int base = name.count && name.data[0] == '/' ? 2 : 0; base < 3; ++base) {
+		for (size_t i = 0; i < sizeof(suffixes) / sizeof(*suffixes); ++i) {
+			switch (base) {
+			break; case 0: snprintf(path, size, "%.*s%s/" SV_Fmt "%s", page_dir, page_path, parent, SV_Arg(name), suffixes[i]);
+			break; case 1: snprintf(path, size, "%.*s/" SV_Fmt "%s", page_dir, page_path, SV_Arg(name), suffixes[i]);
+			break; case 2: snprintf(path, size, SV_Fmt "%s", SV_Arg(name), suffixes[i]);
+			}
+			if (stat(path, st) == 0 && S_ISREG(st->st_mode)) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static char const* read_include(char const* path, String_View *content)
+{
+	FILE *f = fopen(path, "r");
+	struct stat st;
+	if (!f || fstat(fileno(f), &st) != 0) {
+		char const* error = strerror(errno);
+		if (f) {
+			fclose(f);
+		}
+		return error;
+	}
+	char *data = malloc(st.st_size + 1);
+	size_t count = data ? fread(data, 1, st.st_size, f) : 0;
+	char const* error = !data ? strerror(ENOMEM) : ferror(f) ? strerror(errno) : NULL;
+	fclose(f);
+	if (error) {
+		free(data);
+		return error;
+	}
+	data[count] = '\0';
+	*content = sv_from_parts(data, count);
+	return NULL;
+}
+
+// Returns include of given file, reading and parsing it when it isn't cached or changed since
+static Included_File* load_include(Msg_Config const* config, char const* path, struct stat const* st)
+{
+	uint64_t hash = ((uint64_t)st->st_dev * 0x100000001b3) ^ (uint64_t)st->st_ino;
+	Included_File **bucket = &includes.buckets[hash % Msg_Include_Buckets];
+
+	pthread_mutex_lock(&includes.lock);
+	for (Included_File *include = *bucket; include; include = include->next) {
+		if (include->device != st->st_dev || include->inode != st->st_ino) {
+			continue;
+		}
+		if (include->mtime.tv_sec == st->st_mtim.tv_sec && include->mtime.tv_nsec == st->st_mtim.tv_nsec) {
+			while (include->loading) {
+				pthread_cond_wait(&includes.loaded, &includes.lock);
+			}
+			pthread_mutex_unlock(&includes.lock);
+			return include;
+		}
+		// Only newest version of file is looked up
+		break;
+	}
+
+	Included_File *include = calloc(1, sizeof(*include));
+	assert(include);
+	include->path = strdup(path);
+	include->device = st->st_dev;
+	include->inode = st->st_ino;
+	include->mtime = st->st_mtim;
+	include->loading = true;
+	include->next = *bucket;
+	*bucket = include;
+	pthread_mutex_unlock(&includes.lock);
+
+	String_View src;
+	include->page.path = include->path;
+	// Errors of reading are reported by expand_includes, at .so of every page that needs file
+	char const* error = (config->read_include ? config->read_include : read_include)(path, &src);
+	if (!error) {
+		include->page.source = src;
+		size_t lines;
+		include->ok = parse_lines(config, src, dialect_of(src), true, &include->page, &lines);
+	} else {
+		include->error = strdup(error);
+	}
+
+	pthread_mutex_lock(&includes.lock);
+	include->loading = false;
+	pthread_cond_broadcast(&includes.loaded);
+	pthread_mutex_unlock(&includes.lock);
+	return include;
+}
+
+// Copies sections and commands of from into page, replacing .so with content of included files.
+// Names of included files are resolved against path of page that is parsed.
+static bool expand_includes(Msg_Config const* config, char const* page_path, Page const* from, Page *into, Include_Chain const* chain, size_t depth)
+{
+	for (size_t i = 0; i < from->sections_count; ++i) {
+		Section const* section = &from->sections[i];
+		if (section->name.data) {
+			Push(*into, sections);
+			Back(*into, sections)->name = section->name;
+		}
+
+		for (size_t j = 0; j < section->commands_count; ++j) {
+			Command const* command = &section->commands[j];
+			if (command->type != Include) {
+				if (into->sections_count == 0) {
+					msg_report(config, Msg_Error, from->path, line_of(from->source, command->value.data), 1, "trying to add text without specifing section header .SH");
+					return false;
+				}
+				push_command(into, command->type, command->value);
+				continue;
+			}
+
+			String_View name = sv_trim(command->value);
+			char path[PATH_MAX];
+			struct stat st;
+			if (!resolve_include(page_path, name, path, sizeof(path), &st)) {
+				msg_report(config, Msg_Error, from->path, line_of(from->source, command->value.data), 1, "couldn't find included file " SV_Fmt, SV_Arg(name));
+				return false;
+			}
+			for (Include_Chain const* link = chain; link; link = link->next) {
+				if (link->device == st.st_dev && link->inode == st.st_ino) {
+					msg_report(config, Msg_Error, from->path, line_of(from->source, command->value.data), 1, "%s is already being included", path);
+					return false;
+				}
+			}
+			if (depth == Msg_Include_Depth) {
+				msg_report(config, Msg_Error, from->path, line_of(from->source, command->value.data), 1, "includes are nested deeper than %d files", Msg_Include_Depth);
+				return false;
+			}
+
+			// Errors of included file itself are reported once, when it is parsed,
+			// but every page that includes it learns why it isn't built
+			Included_File const* include = load_include(config, path, &st);
+			if (include->error) {
+				msg_report(config, Msg_Error, from->path, line_of(from->source, command->value.data), 1, "couldn't read included file %s: %s", path, include->error);
+				return false;
+			}
+			if (!include->ok) {
+				msg_report(config, Msg_Error, from->path, line_of(from->source, command->value.data), 1, "included file %s has errors", path);
+				return false;
+			}
+			for (size_t k = 0; k < Title_Fields; ++k) {
+				if (include->page.title[k].data && !into->title[k].data) {
+					into->title[k] = include->page.title[k];
+				}
+			}
+
+			Include_Chain link = { .device = st.st_dev, .inode = st.st_ino, .next = chain };
+			if (!expand_includes(config, page_path, &include->page, into, &link, depth + 1)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+MSGDEF bool parse_page(Msg_Config const* config, char const* path, String_View src, Page *result)
+{
+	Page page = {
+		.path = path,
+		.source = src,
+	};
+
+	// Parts of mdoc page can't be parsed separately, they depend on name given by first .Nm,
+	// neither can parts of pages that define macros used later
+	Dialect dialect = dialect_of(src);
+	size_t parts = dialect == Dialect_Man ? parts_for(config, src.count) : 1;
+	if (parts > 1 && has_state(src)) {
+		parts = 1;
+	}
+	if (parts > 1) {
+		if (!parse_page_parallel(config, &page, parts)) {
+			return false;
+		}
+	} else {
+		size_t lines;
+		if (!parse_lines(config, src, dialect, false, &page, &lines)) {
+			return false;
+		}
+	}
+
+	if (has_includes(&page)) {
+		// Expanded page takes over text generated while parsing
+		Page expanded = { .path = page.path, .source = page.source };
+		memcpy(expanded.title, page.title, sizeof(page.title));
+		expanded.buffers = page.buffers;
+		expanded.buffers_count = page.buffers_count;
+		expanded.buffers_capacity = page.buffers_capacity;
+		page.buffers = NULL;
+		page.buffers_count = 0;
+		// Page itself is the first file of chain, when it is file at all
+		struct stat st;
+		Include_Chain root = {0};
+		bool is_file = stat(path, &st) == 0;
+		if (is_file) {
+			root = (Include_Chain) { .device = st.st_dev, .inode = st.st_ino };
+		}
+		bool ok = expand_includes(config, path, &page, &expanded, is_file ? &root : NULL, 0);
+		free_page(&page);
+		if (!ok) {
+			free_page(&expanded);
+			return false;
+		}
+		page = expanded;
+	}
+
+	*result = page;
+	return true;
+}
+
+MSGDEF void free_page(Page *page)
+{
+	for (size_t i = 0; i < page->sections_count; ++i) {
+		free(page->sections[i].commands);
+	}
+	free(page->sections);
+	for (size_t i = 0; i < page->buffers_count; ++i) {
+		free(page->buffers[i]);
+	}
+	free(page->buffers);
+	*page = (Page) {0};
+}
+
+// Writes markup or its compact equivalent when minifying, keeping tally of saved bytes.
+static void emit(Msg_Config const* config, Output *out, char const* markup, char const* compact)
+{
+	if (config->minify) {
+		out->minify_saved += strlen(markup) - strlen(compact);
+		out_cstr(out, compact);
+	} else {
+		out_cstr(out, markup);
+	}
+}
+
+static void print_link_to(String_View src, Output *out)
+{
+	src = sv_trim(src);
+	String_View href = sv_trim(sv_chop_by_delim(&src, ' '));
+	src = sv_trim(src);
+
+	out_cstr(out, "<a href=\""); out_sv(out, href); out_cstr(out, "\">"); out_sv(out, src); out_cstr(out, "</a>");
+}
+
+static void print_root_colors(Msg_Config const* config, Output *out)
+{
+	emit(config, out, ":root { --background-color: ", ":root{--background-color:");
+	out_cstr(out, config->background_color);
+	emit(config, out, "deg; --text-color: ", "deg;--text-color:");
+	out_cstr(out, config->text_color);
+	emit(config, out, "deg; --accent-color: ", "deg;--accent-color:");
+	out_cstr(out, config->accent_color);
+	emit(config, out, "deg; }", "deg}");
+}
+
+// Writes everything up to content of page: head with title and stylesheet and opening of body.
+static void print_head(Msg_Config const* config, String_View title, Output *out)
+{
+	out_cstr(out, "<!DOCTYPE html>"); emit(config, out, "\n", "");
+	out_cstr(out, "<html>"); emit(config, out, "\n", "");
+	out_cstr(out, "<head>"); emit(config, out, "\n", "");
+	emit(config, out, "<meta charset=\"utf-8\" />\n", "<meta charset=utf-8>");
+	out_cstr(out, "<title>"); out_sv(out, title); out_cstr(out, "</title>"); // TODO add escaping resolution
+	emit(config, out, "\n", "");
+	if (config->stylesheet_href) {
+		out_cstr(out, "<link rel=\"stylesheet\" href=\""); out_cstr(out, config->stylesheet_href); out_cstr(out, "\"");
+		emit(config, out, " />\n", ">");
+	} else {
+		out_cstr(out, "<style>"); emit(config, out, "\n", "");
+		print_root_colors(config, out);
+		emit(config, out, "</style>\n<style>", "");
+		out_sv(out, config->theme);
+		out->minify_saved += config->theme_minify_saved;
+		out_cstr(out, "</style>");
+		emit(config, out, "\n", "");
+	}
+	out_cstr(out, "</head>"); emit(config, out, "\n", "");
+
+	out_cstr(out, "<body>"); emit(config, out, "\n", "");
+	out_cstr(out, "<div class=\"content\">"); emit(config, out, "\n", "");
+}
+
+static void print_foot(Msg_Config const* config, Output *out)
+{
+	out_cstr(out, "</div>"); emit(config, out, "\n", "");
+	out_cstr(out, "</body>"); emit(config, out, "\n", "");
+	out_cstr(out, "</html>"); emit(config, out, "\n", "");
+}
+
+// Anchor of section is slug of its name: lowercase letters and digits with other
+// characters collapsed into single '-'. Slugs of sections with the same name get
+// suffix _2, _3, ..., which can't collide with any slug since slugs never contain '_'.
+// Anchors only depend on names and order of sections, so they are stable across rebuilds.
+typedef struct anchor
+{
+	String_View slug;
+	size_t duplicate;
+} Anchor;
+
+static String_View slugify(String_View name, Output *out)
+{
+	char *slug = out_reserve(out, name.count > sizeof("section") ? name.count : sizeof("section"));
+	size_t count = 0;
+	for (size_t i = 0; i < name.count; ++i) {
+		unsigned char c = name.data[i];
+		if (isalnum(c)) {
+			slug[count++] = tolower(c);
+		} else if (count > 0 && slug[count-1] != '-') {
+			slug[count++] = '-';
+		}
+	}
+	if (count > 0 && slug[count-1] == '-') {
+		--count;
+	}
+	if (count == 0) {
+		memcpy(slug, "section", count = sizeof("section") - 1);
+	}
+	return sv_from_parts(slug, count);
+}
+
+// Computes anchors of all sections at once. Slugs are written to blocks of output,
+// duplicates are counted with hash table, so only two allocations are made per page.
+static Anchor* section_anchors(Page const* page, Output *out)
+{
+	size_t count = page->sections_count;
+	Anchor *anchors = calloc(count, sizeof(*anchors));
+	size_t table_size = 16;
+	while (table_size < 2 * count) {
+		table_size *= 2;
+	}
+	size_t *table = calloc(table_size, sizeof(*table));
+	assert(anchors && table);
+
+	for (size_t i = 0; i < count; ++i) {
+		String_View slug = slugify(page->sections[i].name, out);
+		anchors[i] = (Anchor) { .slug = slug, .duplicate = 1 };
+
+		uint64_t hash = 0xcbf29ce484222325;
+		for (size_t j = 0; j < slug.count; ++j) {
+			hash = (hash ^ (unsigned char)slug.data[j]) * 0x100000001b3;
+		}
+
+		// Table stores index of last section with given slug plus one, zero marks empty slot
+		for (size_t k = hash & (table_size - 1);; k = (k + 1) & (table_size - 1)) {
+			if (table[k] == 0) {
+				table[k] = i + 1;
+				break;
+			}
+			Anchor *previous = &anchors[table[k] - 1];
+			if (sv_eq(previous->slug, slug)) {
+				anchors[i].duplicate = previous->duplicate + 1;
+				table[k] = i + 1;
+				break;
+			}
+		}
+	}
+
+	free(table);
+	return anchors;
+}
+
+static void print_anchor(Anchor const* anchor, Output *out)
+{
+	out_sv(out, anchor->slug);
+	if (anchor->duplicate > 1) {
+		char *suffix = out_reserve(out, 24);
+		out_sv(out, sv_from_parts(suffix, snprintf(suffix, 24, "_%zu", anchor->duplicate)));
+	}
+}
+
+// Font commands alternate between two fonts for each argument, roman font has no tag
+static void print_fonts(Command const* command, Output *out)
+{
+	static char const* const fonts[][2] = {
+		[Bold]         = { "b", "b" },
+		[Italic]       = { "i", "i" },
+		[Bold_Roman]   = { "b", NULL },
+		[Italic_Roman] = { "i", NULL },
+		[Roman_Bold]   = { NULL, "b" },
+		[Roman_Italic] = { NULL, "i" },
+		[Bold_Italic]  = { "b", "i" },
+		[Italic_Bold]  = { "i", "b" },
+	};
+
+	String_View args = command->value, arg;
+	for (size_t i = 0; next_argument(&args, &arg); ++i) {
+		char const* font = fonts[command->type][i % 2];
+		// Single font commands keep spaces between arguments
+		if (i > 0 && (command->type == Bold || command->type == Italic)) {
+			out_cstr(out, " ");
+		}
+		if (font) {
+			out_cstr(out, "<"); out_cstr(out, font); out_cstr(out, ">");
+			out_sv(out, arg);
+			out_cstr(out, "</"); out_cstr(out, font); out_cstr(out, ">");
+		} else {
+			out_sv(out, arg);
+		}
+	}
+}
+
+// Punctuation is attached to previous word, opening parenthesis to next one
+static bool is_closing(String_View word)
+{
+	return word.count == 1 && strchr(".,:;)]?!", word.data[0]);
+}
+
+static bool is_opening(String_View word)
+{
+	return word.count == 1 && strchr("([", word.data[0]);
+}
+
+// Prints words of mdoc line in given style, switching it at every callable macro.
+// Enclosing macros like .Op wrap the rest of line.
+static void print_inline(Style style, String_View args, Output *out)
+{
+	static char const* const enclosures[][2] = {
+		[Style_Optional]      = { "[", "]" },
+		[Style_Quoted]        = { "\u201c", "\u201d" },
+		[Style_Single_Quoted] = { "\u2018", "\u2019" },
+		[Style_Parenthesized] = { "(", ")" },
+		[Style_Angled]        = { "&lt;", "&gt;" },
+	};
+
+	char const* closers[8];
+	size_t closers_count = 0;
+	bool space = false;  // space goes before next word
+	bool empty = false;  // .Fl or .Ar that didn't get any word yet
+	size_t words = 0;    // words in current style, .Xr puts second one in parentheses
+
+	for (String_View arg;;) {
+		bool more = next_argument(&args, &arg);
+		Style next = more ? mdoc_style(macro_code(arg)) : Style_None;
+		if (empty && (!more || next != Style_None)) {
+			out_cstr(out, space ? " " : "");
+			out_cstr(out, style == Style_Flag ? "<b>-</b>" : "<i>file ...</i>");
+			space = true;
+			empty = false;
+		}
+		if (!more) {
+			break;
+		}
+
+		switch (next) {
+		break; case Style_None:
+			if (is_closing(arg)) {
+				// Punctuation at the end of line goes after enclosures
+				String_View rest = args, word;
+				bool trailing = true;
+				while (trailing && next_argument(&rest, &word)) {
+					trailing = is_closing(word);
+				}
+				while (trailing && closers_count > 0) {
+					out_cstr(out, closers[--closers_count]);
+				}
+				out_sv(out, arg);
+				space = true;
+				continue;
+			}
+			if (space && !(style == Style_Reference && words == 1)) {
+				out_cstr(out, " ");
+			}
+			switch (style) {
+			break; case Style_Bold:   out_cstr(out, "<b>"); out_sv(out, arg); out_cstr(out, "</b>");
+			break; case Style_Italic: case Style_Argument: out_cstr(out, "<i>"); out_sv(out, arg); out_cstr(out, "</i>");
+			break; case Style_Flag:   out_cstr(out, "<b>-"); out_sv(out, arg); out_cstr(out, "</b>");
+			break; case Style_Reference:
+				if (words == 1) {
+					out_cstr(out, "("); out_sv(out, arg); out_cstr(out, ")");
+					style = Style_Plain;
+				} else {
+					out_sv(out, arg);
+				}
+			break; default: out_sv(out, arg);
+			}
+			++words;
+			empty = false;
+			space = !is_opening(arg);
+		break; case Style_No_Space:
+			space = false;
+		break; case Style_Optional: case Style_Quoted: case Style_Single_Quoted: case Style_Parenthesized: case Style_Angled:
+			if (space) {
+				out_cstr(out, " ");
+			}
+			out_cstr(out, enclosures[next][0]);
+			if (closers_count < sizeof(closers) / sizeof(*closers)) {
+				closers[closers_count++] = enclosures[next][1];
+			}
+			style = Style_Plain;
+			space = false;
+		break; case Style_Skip:
+		break; case Style_Open_Optional: case Style_Open_Parenthesis:
+			if (space) {
+				out_cstr(out, " ");
+			}
+			out_cstr(out, next == Style_Open_Optional ? "[" : "(");
+			space = false;
+		break; case Style_Close_Optional: case Style_Close_Parenthesis:
+			out_cstr(out, next == Style_Close_Optional ? "]" : ")");
+			space = true;
+		break; default:
+			style = next;
+			empty = next == Style_Flag || next == Style_Argument;
+			words = 0;
+		}
+	}
+
+	while (closers_count > 0) {
+		out_cstr(out, closers[--closers_count]);
+	}
+}
+
+// Lists of mdoc nest deeper than this are rendered as part of outer list
+#define Msg_List_Depth 16
+
+// Blocks opened by paragraph macros, closed by next one or by end of section
+typedef struct blocks
+{
+	bool paragraph;  // <p>
+	bool definition; // <dl><dt>...</dt><dd>
+	bool tag;        // <dt> of .TP waiting for its line
+	bool no_fill;    // <pre>
+	size_t indent;   // nested <div class="indent">
+
+	// Open mdoc lists from outermost, element is "dl", "ul" or "ol"
+	struct {
+		char const* element;
+		bool item;
+	} lists[Msg_List_Depth];
+	size_t lists_count;
+	size_t lists_overflow;
+} Blocks;
+
+static void close_list_item(Blocks *blocks, Output *out)
+{
+	if (blocks->lists_count > 0 && blocks->lists[blocks->lists_count - 1].item) {
+		out_cstr(out, strcmp(blocks->lists[blocks->lists_count - 1].element, "dl") == 0 ? "</dd>" : "</li>");
+		blocks->lists[blocks->lists_count - 1].item = false;
+	}
+}
+
+static void close_list(Msg_Config const* config, Blocks *blocks, Output *out)
+{
+	if (blocks->lists_overflow > 0) {
+		--blocks->lists_overflow;
+		return;
+	}
+	if (blocks->lists_count > 0) {
+		close_list_item(blocks, out);
+		char const* element = blocks->lists[--blocks->lists_count].element;
+		out_cstr(out, "</"); out_cstr(out, element); out_cstr(out, ">"); emit(config, out, "\n", "");
+	}
+}
+
+static void close_paragraph(Msg_Config const* config, Blocks *blocks, Output *out)
+{
+	if (blocks->tag) {
+		out_cstr(out, "</dt>");
+		blocks->tag = false;
+	} else if (blocks->definition) {
+		out_cstr(out, "</dd>");
+	}
+	if (blocks->definition) {
+		out_cstr(out, "</dl>"); emit(config, out, "\n", "");
+		blocks->definition = false;
+	}
+	if (blocks->paragraph) {
+		out_cstr(out, "</p>"); emit(config, out, "\n", "");
+		blocks->paragraph = false;
+	}
+}
+
+// Text outside of any block starts paragraph, which is closed like one of .PP
+static void open_paragraph(Blocks *blocks, Output *out)
+{
+	if (!blocks->paragraph && !blocks->definition && !blocks->no_fill && blocks->lists_count == 0) {
+		out_cstr(out, "<p>");
+		blocks->paragraph = true;
+	}
+}
+
+static void close_blocks(Msg_Config const* config, Blocks *blocks, Output *out)
+{
+	if (blocks->no_fill) {
+		out_cstr(out, "</pre>"); emit(config, out, "\n", "");
+		blocks->no_fill = false;
+	}
+	close_paragraph(config, blocks, out);
+	for (; blocks->indent > 0; --blocks->indent) {
+		out_cstr(out, "</div>"); emit(config, out, "\n", "");
+	}
+	blocks->lists_overflow = 0;
+	while (blocks->lists_count > 0) {
+		close_list(config, blocks, out);
+	}
+}
+
+static void print_sections_range(Msg_Config const* config, Page const* page, Anchor const* anchors, size_t from, size_t to, Output *out)
+{
+	for (size_t i = from; i < to; ++i) {
+		Section const* section = &page->sections[i];
+		if (anchors) {
+			out_cstr(out, "<section id=\""); print_anchor(&anchors[i], out); out_cstr(out, "\">");
+		} else {
+			out_cstr(out, "<section>");
+		}
+		emit(config, out, "\n", "");
+		out_cstr(out, "<h2>"); out_sv(out, section->name); out_cstr(out, "</h2>");
+
+		Blocks blocks = {0};
+		for (int j = 0; j < section->commands_count; ++j) {
+			Command const* command = &section->commands[j];
+			bool tag = blocks.tag;
+			String_View arg;
+
+			switch (command->type) {
+			break; case Text:
+				if (blocks.no_fill) {
+					// Preformatted lines keep their line breaks even when minified
+					out_sv(out, command->value);
+					out_cstr(out, "\n");
+				} else {
+					open_paragraph(&blocks, out);
+					out_sv(out, command->value);
+					char const* end = command->value.data + command->value.count;
+					if (!config->minify && end >= page->source.data && end < page->source.data + page->source.count && *end == '\n') {
+						// Reuse line break from source, so consecutive lines become single slice
+						out_sv(out, (String_View) { .data = end, .count = 1 });
+					} else {
+						// Line break inside text is significant as whitespace, keep it as single space
+						emit(config, out, "\n", " ");
+					}
+				}
+			break; case Link:
+				open_paragraph(&blocks, out);
+				print_link_to(command->value, out);
+			break; case Subsection:
+				close_paragraph(config, &blocks, out);
+				out_cstr(out, "<h3>"); out_sv(out, command->value); out_cstr(out, "</h3>"); emit(config, out, "\n", "");
+				tag = false;
+			break; case Paragraph:
+				close_paragraph(config, &blocks, out);
+				out_cstr(out, "<p>");
+				blocks.paragraph = true;
+				tag = false;
+			break; case Hanging_Paragraph:
+				close_paragraph(config, &blocks, out);
+				out_cstr(out, "<p class=\"hanging\">");
+				blocks.paragraph = true;
+				tag = false;
+			break; case Tagged_Paragraph:
+				close_paragraph(config, &blocks, out);
+				out_cstr(out, "<dl><dt>");
+				blocks.definition = blocks.tag = true;
+				tag = false;
+			break; case Indented_Paragraph:
+				close_paragraph(config, &blocks, out);
+				out_cstr(out, "<dl><dt>");
+				String_View args = command->value;
+				if (next_argument(&args, &arg)) {
+					out_sv(out, arg);
+				}
+				out_cstr(out, "</dt><dd>");
+				blocks.definition = true;
+				tag = false;
+			break; case Indent:
+				close_paragraph(config, &blocks, out);
+				out_cstr(out, "<div class=\"indent\">"); emit(config, out, "\n", "");
+				++blocks.indent;
+				tag = false;
+			break; case Unindent:
+				close_paragraph(config, &blocks, out);
+				if (blocks.indent > 0) {
+					out_cstr(out, "</div>"); emit(config, out, "\n", "");
+					--blocks.indent;
+				}
+				tag = false;
+			break; case Bold: case Italic:
+			case Bold_Roman: case Italic_Roman: case Roman_Bold: case Roman_Italic: case Bold_Italic: case Italic_Bold:
+				open_paragraph(&blocks, out);
+				print_fonts(command, out);
+				if (!tag) {
+					emit(config, out, "\n", " ");
+				}
+			break; case No_Fill: case Preformatted:
+				if (!blocks.no_fill) {
+					if (blocks.paragraph) {
+						out_cstr(out, "</p>"); emit(config, out, "\n", "");
+						blocks.paragraph = false;
+					}
+					out_cstr(out, "<pre>");
+					blocks.no_fill = true;
+				}
+				if (command->type == Preformatted) {
+					// Whole block is single slice, already escaped by parser
+					out_sv(out, command->value);
+					out_cstr(out, "\n");
+				}
+				tag = false;
+			break; case Fill:
+				if (blocks.no_fill) {
+					out_cstr(out, "</pre>"); emit(config, out, "\n", "");
+					blocks.no_fill = false;
+				}
+				tag = false;
+			break; case Name:
+				open_paragraph(&blocks, out);
+				print_inline(Style_Bold, command->value, out);
+				emit(config, out, "\n", " ");
+			break; case Description:
+				open_paragraph(&blocks, out);
+				out_cstr(out, "\u2014 ");
+				print_inline(Style_Plain, command->value, out);
+				emit(config, out, "\n", " ");
+			break; case Inline:
+				open_paragraph(&blocks, out);
+				print_inline(Style_Plain, command->value, out);
+				emit(config, out, "\n", " ");
+			break; case List_Begin: {
+				close_paragraph(config, &blocks, out);
+				if (blocks.lists_count == Msg_List_Depth) {
+					++blocks.lists_overflow;
+					break;
+				}
+				String_View args = command->value, kind = SV_NULL;
+				next_argument(&args, &kind);
+				char const* element = "ul";
+				if (sv_eq(kind, SV("-tag")) || sv_eq(kind, SV("-hang")) || sv_eq(kind, SV("-ohang"))
+						|| sv_eq(kind, SV("-inset")) || sv_eq(kind, SV("-diag"))) {
+					element = "dl";
+				} else if (sv_eq(kind, SV("-enum"))) {
+					element = "ol";
+				}
+				blocks.lists[blocks.lists_count].element = element;
+				blocks.lists[blocks.lists_count++].item = false;
+				out_cstr(out, "<"); out_cstr(out, element); out_cstr(out, ">"); emit(config, out, "\n", "");
+			}
+			break; case List_End:
+				close_paragraph(config, &blocks, out);
+				close_list(config, &blocks, out);
+			break; case List_Item:
+				close_paragraph(config, &blocks, out);
+				close_list_item(&blocks, out);
+				if (blocks.lists_count > 0 && strcmp(blocks.lists[blocks.lists_count - 1].element, "dl") == 0) {
+					out_cstr(out, "<dt>");
+					print_inline(Style_Plain, command->value, out);
+					out_cstr(out, "</dt><dd>");
+				} else {
+					out_cstr(out, "<li>");
+					if (command->value.count) {
+						print_inline(Style_Plain, command->value, out);
+						emit(config, out, "\n", " ");
+					}
+				}
+				if (blocks.lists_count > 0) {
+					blocks.lists[blocks.lists_count - 1].item = true;
+				}
+			// Includes are expanded by parse_page
+			break; case Include: case Command_Types: assert(0 && "unreachable");
+			}
+
+			// First line after .TP is its tag
+			if (tag) {
+				out_cstr(out, "</dt><dd>");
+				blocks.tag = false;
+			}
+		}
+		close_blocks(config, &blocks, out);
+
+		out_cstr(out, "</section>"); emit(config, out, "\n", "");
+	}
+}
+
+// Range of sections rendered by one thread into its own output
+typedef struct sections_part
+{
+	Msg_Config const* config;
+	Page const* page;
+	Anchor const* anchors;
+	size_t begin, end;
+	Output out;
+} Sections_Part;
+
+static void* print_sections_part(void *data)
+{
+	Sections_Part *part = data;
+	print_sections_range(part->config, part->page, part->anchors, part->begin, part->end, &part->out);
+	return NULL;
+}
+
+// Large pages are rendered by parts of sections in parallel. Slices of parts
+// are appended in order, so adjacent ones merge the same way as in serial run.
+static void print_sections(Msg_Config const* config, Page const* page, Anchor const* anchors, size_t from, size_t to, Output *out)
+{
+	char const* source_end = page->source.data + page->source.count;
+	char const* start = from < to ? page->sections[from].name.data : source_end;
+	char const* stop = to < page->sections_count ? page->sections[to].name.data : source_end;
+	// Sections from included files don't point into source, so their size isn't known
+	bool in_source = start >= page->source.data && start <= stop && stop <= source_end;
+	size_t parts_count = in_source ? parts_for(config, stop - start) : 1;
+	if (parts_count > to - from) {
+		parts_count = to - from;
+	}
+	if (parts_count <= 1) {
+		print_sections_range(config, page, anchors, from, to, out);
+		return;
+	}
+
+	Sections_Part *parts = calloc(parts_count, sizeof(*parts));
+	pthread_t *threads = calloc(parts_count, sizeof(*threads));
+	assert(parts && threads);
+
+	size_t begin = from;
+	for (size_t i = 0; i < parts_count; ++i) {
+		size_t end = begin + 1;
+		if (i + 1 == parts_count) {
+			end = to;
+		} else {
+			// Split by position of section in source, which approximates amount of work
+			char const* target = start + (stop - start) / parts_count * (i + 1);
+			while (end < to - (parts_count - i - 1) && page->sections[end].name.data < target) {
+				++end;
+			}
+		}
+		parts[i] = (Sections_Part) { .config = config, .page = page, .anchors = anchors, .begin = begin, .end = end };
+		begin = end;
+	}
+
+	for (size_t i = 1; i < parts_count; ++i) {
+		int error = pthread_create(&threads[i], NULL, print_sections_part, &parts[i]);
+		assert(error == 0);
+	}
+	print_sections_part(&parts[0]);
+	for (size_t i = 1; i < parts_count; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+
+	for (size_t i = 0; i < parts_count; ++i) {
+		Output *part = &parts[i].out;
+		for (size_t j = 0; j < part->parts_count; ++j) {
+			out_sv(out, sv_from_parts(part->parts[j].iov_base, part->parts[j].iov_len));
+		}
+		out->minify_saved += part->minify_saved;
+		// Generated text of part is referenced by slices, so its blocks are kept until out is freed
+		for (size_t j = 0; j < part->blocks_count; ++j) {
+			Push(*out, blocks);
+			*Back(*out, blocks) = part->blocks[j];
+		}
+		if (part->blocks_count > 0) {
+			out->block_used = Output_Block_Size;
+		}
+		free(part->blocks);
+		free(part->parts);
+	}
+
+	free(threads);
+	free(parts);
+}
+
+static void print_toc_item(Msg_Config const* config, Page const* page, Anchor const* anchors, size_t section, Output *out)
+{
+	out_cstr(out, "<li><a href=\"#");
+	print_anchor(&anchors[section], out);
+	out_cstr(out, "\">"); out_sv(out, page->sections[section].name); out_cstr(out, "</a></li>");
+	emit(config, out, "\n", "");
+}
+
+static void print_part_href(char const* name, size_t part, Output *out)
+{
+	out_cstr(out, name);
+	if (part > 0) {
+		char *number = out_reserve(out, 24);
+		out_sv(out, sv_from_parts(number, snprintf(number, 24, ".%zu", part + 1)));
+	}
+	out_cstr(out, ".html");
+}
+
+static void print_pager(Msg_Config const* config, char const* name, size_t part, size_t parts_count, Output *out)
+{
+	out_cstr(out, "<nav class=\"pager\">"); emit(config, out, "\n", "");
+	if (part > 0) {
+		out_cstr(out, "<a rel=\"prev\" href=\""); print_part_href(name, part - 1, out); out_cstr(out, "\">previous</a>");
+		emit(config, out, "\n", "");
+	}
+	char *label = out_reserve(out, 64);
+	out_cstr(out, "<span>");
+	out_sv(out, sv_from_parts(label, snprintf(label, 64, "part %zu of %zu", part + 1, parts_count)));
+	out_cstr(out, "</span>"); emit(config, out, "\n", "");
+	if (part + 1 < parts_count) {
+		out_cstr(out, "<a rel=\"next\" href=\""); print_part_href(name, part + 1, out); out_cstr(out, "\">next</a>");
+		emit(config, out, "\n", "");
+	}
+	out_cstr(out, "</nav>"); emit(config, out, "\n", "");
+}
+
+// Renders sections from..to of page. Anchors are computed for whole page,
+// so they are the same whether page is paginated or not.
+static bool print_page_range(Msg_Config const* config, Page const* page, size_t from, size_t to, char const* name, size_t part, size_t parts_count, Output *out)
+{
+	print_head(config, page->title[4], out);
+	out_cstr(out, "<header>"); emit(config, out, "\n", "");
+	for (int i = 0; i < 3; ++i) {
+		out_cstr(out, "<div>");
+		if (i == 1) {
+			out_cstr(out, "<h1>"); out_sv(out, page->title[4]); out_cstr(out, "</h1>");
+		} else {
+			out_sv(out, page->title[0]); out_cstr(out, "("); out_sv(out, page->title[1]); out_cstr(out, ")");
+		}
+		out_cstr(out, "</div>"); emit(config, out, "\n", "");
+	}
+	out_cstr(out, "</header>"); emit(config, out, "\n", "");
+
+	if (parts_count > 1) {
+		print_pager(config, name, part, parts_count, out);
+	}
+
+	Anchor *anchors = config->toc ? section_anchors(page, out) : NULL;
+	if (anchors) {
+		out_cstr(out, "<nav>"); emit(config, out, "\n", "");
+		out_cstr(out, "<h2>CONTENTS</h2>"); emit(config, out, "\n", "");
+		out_cstr(out, "<ul>"); emit(config, out, "\n", "");
+		for (size_t i = from; i < to; ++i) {
+			print_toc_item(config, page, anchors, i, out);
+		}
+		out_cstr(out, "</ul>"); emit(config, out, "\n", "");
+		out_cstr(out, "</nav>"); emit(config, out, "\n", "");
+	}
+
+	print_sections(config, page, anchors, from, to, out);
+
+	if (parts_count > 1) {
+		print_pager(config, name, part, parts_count, out);
+	}
+
+	out_cstr(out, "<footer>"); emit(config, out, "\n", "");
+	String_View footer[] = { page->title[3], page->title[2], page->title[3] };
+	for (int i = 0; i < 3; ++i) {
+		out_cstr(out, "<div>"); out_sv(out, footer[i]); out_cstr(out, "</div>"); emit(config, out, "\n", "");
+	}
+	out_cstr(out, "</footer>"); emit(config, out, "\n", "");
+
+	print_foot(config, out);
+	free(anchors);
+	return !out->failed;
+}
+
+MSGDEF bool print_page_to(Msg_Config const* config, Page const* page, Output *out)
+{
+	return print_page_range(config, page, 0, page->sections_count, NULL, 0, 1, out);
+}
+
+// Size of every section is measured by rendering it alone into scratch output,
+// which only collects slices, then sections are packed greedily into parts.
+MSGDEF size_t paginate_page(Msg_Config const* config, Page const* page, char const* name, size_t **breaks)
+{
+	struct {
+		size_t *parts;
+		size_t parts_count;
+		size_t parts_capacity;
+	} result = {0};
+	Push(result, parts);
+	*Back(result, parts) = 0;
+
+	if (config->max_bytes == 0 && config->max_commands == 0) {
+		*breaks = result.parts;
+		return 1;
+	}
+
+	// Part in the middle of many has the longest pager, so it bounds what every part spends outside of sections
+	Output scratch = {0};
+	print_page_range(config, page, 0, 0, name, 99998, 99999, &scratch);
+	size_t overhead = scratch.bytes;
+	Anchor *anchors = config->toc ? section_anchors(page, &scratch) : NULL;
+
+	size_t bytes = overhead, commands = 0;
+	for (size_t i = 0; i < page->sections_count; ++i) {
+		scratch.bytes = 0;
+		scratch.parts_count = 0;
+		if (anchors) {
+			print_toc_item(config, page, anchors, i, &scratch);
+		}
+		print_sections_range(config, page, anchors, i, i + 1, &scratch);
+		size_t section_commands = page->sections[i].commands_count;
+
+		bool over_bytes = config->max_bytes && bytes + scratch.bytes > config->max_bytes;
+		bool over_commands = config->max_commands && commands + section_commands > config->max_commands;
+		if (i > *Back(result, parts) && (over_bytes || over_commands)) {
+			Push(result, parts);
+			*Back(result, parts) = i;
+			bytes = overhead;
+			commands = 0;
+		}
+		bytes += scratch.bytes;
+		commands += section_commands;
+	}
+
+	free(anchors);
+	out_free(&scratch);
+	*breaks = result.parts;
+	return result.parts_count;
+}
+
+MSGDEF bool print_page_part_to(Msg_Config const* config, Page const* page, size_t const* breaks, size_t parts_count, size_t part, char const* name, Output *out)
+{
+	size_t to = part + 1 < parts_count ? breaks[part + 1] : page->sections_count;
+	return print_page_range(config, page, breaks[part], to, name, part, parts_count, out);
+}
+
+// Formats other than HTML share one renderer of plain text, which differs between them
+// in markup of fonts and headings, escaping of characters and indentation.
+MSGDEF size_t msg_utf8_length(String_View text, size_t i)
+{
+	unsigned char c = text.data[i];
+	if (c < 0x80) {
+		return 1;
+	}
+	size_t length = c >= 0xf0 && c <= 0xf4 ? 4 : c >= 0xe0 && c < 0xf0 ? 3 : c >= 0xc2 && c < 0xe0 ? 2 : 0;
+	for (size_t j = 1; length && j < length; ++j) {
+		if (i + j >= text.count || ((unsigned char)text.data[i+j] & 0xc0) != 0x80) {
+			return 0;
+		}
+	}
+	// Reject overlong encodings and surrogates
+	unsigned char next = length > 1 ? text.data[i+1] : 0;
+	if (length == 3 && ((c == 0xe0 && next < 0xa0) || (c == 0xed && next >= 0xa0))) {
+		return 0;
+	}
+	if (length == 4 && ((c == 0xf0 && next < 0x90) || (c == 0xf4 && next >= 0x90))) {
+		return 0;
+	}
+	return length;
+}
+
+typedef struct plain_style
+{
+	char const* bold[2];
+	char const* italic[2];
+	char const* subsection[2];
+	// Before tag of .TP, .IP and .It
+	char const* item;
+	// Around lines of .nf block
+	char const* code[2];
+	// Replacements of characters of text, NULL keeps character
+	char const* const* escapes;
+	// Replacement of bytes that aren't valid UTF-8, NULL keeps them
+	char const* invalid;
+	// Line break inside of text, followed by indentation
+	char const* newline;
+	size_t section_indent;
+	size_t tag_indent;
+	size_t block_indent; // .RS
+} Plain_Style;
+
+static char const* const markdown_escapes[256] = {
+	['\\'] = "\\\\", ['*'] = "\\*", ['_'] = "\\_", ['`'] = "\\`",
+	['<'] = "\\<", ['['] = "\\[", [']'] = "\\]", ['#'] = "\\#",
+};
+
+static char const* const json_escapes[256] = {
+	[0x00] = "\\u0000", [0x01] = "\\u0001", [0x02] = "\\u0002", [0x03] = "\\u0003",
+	[0x04] = "\\u0004", [0x05] = "\\u0005", [0x06] = "\\u0006", [0x07] = "\\u0007",
+	[0x08] = "\\b", [0x09] = "\\t", [0x0a] = "\\n", [0x0b] = "\\u000b",
+	[0x0c] = "\\f", [0x0d] = "\\r", [0x0e] = "\\u000e", [0x0f] = "\\u000f",
+	[0x10] = "\\u0010", [0x11] = "\\u0011", [0x12] = "\\u0012", [0x13] = "\\u0013",
+	[0x14] = "\\u0014", [0x15] = "\\u0015", [0x16] = "\\u0016", [0x17] = "\\u0017",
+	[0x18] = "\\u0018", [0x19] = "\\u0019", [0x1a] = "\\u001a", [0x1b] = "\\u001b",
+	[0x1c] = "\\u001c", [0x1d] = "\\u001d", [0x1e] = "\\u001e", [0x1f] = "\\u001f",
+	['"'] = "\\\"", ['\\'] = "\\\\",
+};
+
+static Plain_Style const text_style = {
+	.bold = { "", "" }, .italic = { "", "" }, .subsection = { "", "" },
+	.item = "", .code = { "", "" },
+	.newline = "\n",
+	.section_indent = 7, .tag_indent = 7, .block_indent = 7,
+};
+
+static Plain_Style const markdown_style = {
+	.bold = { "**", "**" }, .italic = { "*", "*" }, .subsection = { "### ", "" },
+	.item = "- ", .code = { "```\n", "```" },
+	.escapes = markdown_escapes,
+	.newline = "\n",
+	.tag_indent = 2,
+};
+
+static Plain_Style const json_style = {
+	.bold = { "", "" }, .italic = { "", "" }, .subsection = { "", "" },
+	.item = "", .code = { "", "" },
+	.escapes = json_escapes,
+	.invalid = "\\ufffd",
+	.newline = "\\n",
+	.tag_indent = 7, .block_indent = 7,
+};
+
+// Where plain renderer is in section
+typedef struct plain_state
+{
+	Plain_Style const* style;
+	size_t indent;       // of current block
+	size_t body_indent;  // of lines after tag
+	bool tag;            // next command is tag of .TP
+	bool line;           // current line has text, so it was indented already
+	bool blank;          // nothing was written since last blank line
+} Plain_State;
+
+static void plain_indent(Plain_State const* state, Output *out)
+{
+	static char const spaces[] = "                                                                ";
+	size_t count = state->indent < sizeof(spaces) - 1 ? state->indent : sizeof(spaces) - 1;
+	if (count) {
+		out_sv(out, sv_from_parts(spaces, count));
+	}
+}
+
+// Indents line before its first text
+static void plain_start(Plain_State *state, Output *out)
+{
+	if (!state->line) {
+		plain_indent(state, out);
+		state->line = true;
+	}
+	state->blank = false;
+}
+
+// Ends current line, if anything was written on it
+static void plain_end_line(Plain_State *state, Output *out)
+{
+	if (state->line) {
+		out_cstr(out, state->style->newline);
+		state->line = false;
+	}
+}
+
+// Separates blocks with blank line, once
+static void plain_break(Plain_State *state, Output *out)
+{
+	plain_end_line(state, out);
+	if (!state->blank) {
+		out_cstr(out, state->style->newline);
+		state->blank = true;
+	}
+}
+
+// Writes characters escaped for style, keeping runs without special characters as single slice
+static void plain_chars(Plain_State const* state, String_View text, Output *out)
+{
+	char const* const* escapes = state->style->escapes;
+	char const* invalid = state->style->invalid;
+	size_t start = 0;
+	for (size_t i = 0; escapes && i < text.count; ++i) {
+		char const* escape = escapes[(unsigned char)text.data[i]];
+		if (invalid && (unsigned char)text.data[i] >= 0x80) {
+			size_t length = msg_utf8_length(text, i);
+			if (length > 0) {
+				i += length - 1;
+				continue;
+			}
+			escape = invalid;
+		}
+		if (escape) {
+			out_sv(out, sv_from_parts(text.data + start, i - start));
+			out_cstr(out, escape);
+			start = i + 1;
+		}
+	}
+	out_sv(out, sv_from_parts(text.data + start, text.count - start));
+}
+
+// Writes text translated by parser: tags of fonts become markup of style,
+// entities become characters again and line breaks keep indentation.
+// In code, markup and escaping are left out, except for JSON which needs them anyway.
+static void plain_text(Plain_State const* state, String_View text, bool code, Output *out)
+{
+	Plain_Style const* style = state->style;
+	Plain_State chars = *state;
+	if (code && style != &json_style) {
+		chars.style = &text_style;
+	}
+
+	size_t start = 0;
+	for (size_t i = 0; i < text.count; ++i) {
+		char c = text.data[i];
+		if (c != '<' && c != '&' && c != '\n') {
+			continue;
+		}
+		plain_chars(&chars, sv_from_parts(text.data + start, i - start), out);
+		String_View rest = sv_from_parts(text.data + i, text.count - i);
+		size_t length = 1;
+
+		if (c == '\n') {
+			// Line of the same block, indented the same as the first one
+			out_cstr(out, style->newline);
+			plain_indent(state, out);
+		} else if (c == '<') {
+			char const* close = memchr(rest.data, '>', rest.count);
+			length = close ? (size_t)(close - rest.data) + 1 : rest.count;
+			bool closing = length > 1 && rest.data[1] == '/';
+			char font = rest.data[closing ? 2 : 1];
+			if (!code) {
+				out_cstr(out, font == 'b' ? style->bold[closing] : style->italic[closing]);
+			}
+		} else {
+			static struct { char const* entity; char character; } const entities[] = {
+				{ "&lt;", '<' }, { "&gt;", '>' }, { "&amp;", '&' }, { "&quot;", '"' },
+			};
+			static char const characters[] = "<>&\"";
+			size_t k = 0;
+			while (k < 4 && !sv_starts_with(rest, sv_from_cstr(entities[k].entity))) {
+				++k;
+			}
+			if (k < 4) {
+				length = strlen(entities[k].entity);
+				plain_chars(&chars, sv_from_parts(&characters[k], 1), out);
+			} else {
+				plain_chars(&chars, sv_from_parts(rest.data, 1), out);
+			}
+		}
+		i += length - 1;
+		start = i + 1;
+	}
+	if (start < text.count) {
+		plain_chars(&chars, sv_from_parts(text.data + start, text.count - start), out);
+	}
+}
+
+// Writes arguments of font macro in alternating fonts, as print_fonts does
+static void plain_fonts(Plain_State const* state, Command const* command, Output *out)
+{
+	static int const fonts[][2] = {
+		[Bold]         = { 'b', 'b' },
+		[Italic]       = { 'i', 'i' },
+		[Bold_Roman]   = { 'b', 0 },
+		[Italic_Roman] = { 'i', 0 },
+		[Roman_Bold]   = { 0, 'b' },
+		[Roman_Italic] = { 0, 'i' },
+		[Bold_Italic]  = { 'b', 'i' },
+		[Italic_Bold]  = { 'i', 'b' },
+	};
+
+	String_View args = command->value, arg;
+	for (size_t i = 0; next_argument(&args, &arg); ++i) {
+		int font = fonts[command->type][i % 2];
+		char const* const* markup = font == 'b' ? state->style->bold : state->style->italic;
+		if (i > 0 && (command->type == Bold || command->type == Italic)) {
+			out_cstr(out, " ");
+		}
+		if (font) {
+			out_cstr(out, markup[0]);
+		}
+		plain_text(state, arg, false, out);
+		if (font) {
+			out_cstr(out, markup[1]);
+		}
+	}
+}
+
+// Writes words of mdoc line, leaving out names of macros. Flags get their dash,
+// which is all that is left of markup of print_inline in plain text.
+static void plain_inline(Plain_State const* state, String_View args, Output *out)
+{
+	bool space = false, flag = false;
+	for (String_View arg; next_argument(&args, &arg);) {
+		int style = mdoc_style(macro_code(arg));
+		if (style != Style_None) {
+			flag = style == Style_Flag;
+			continue;
+		}
+		if (space && !(arg.count == 1 && strchr(".,:;)]?!", arg.data[0]))) {
+			out_cstr(out, " ");
+		}
+		if (flag) {
+			out_cstr(out, "-");
+			flag = false;
+		}
+		plain_text(state, arg, false, out);
+		space = true;
+	}
+	if (flag) {
+		out_cstr(out, "-");
+	}
+}
+
+// Starts description of tag on the next line, indented deeper than tag
+static void plain_end_tag(Plain_State *state, Output *out)
+{
+	plain_end_line(state, out);
+	state->tag = false;
+	state->indent = state->body_indent;
+}
+
+static void plain_section(Plain_Style const* style, Section const* section, Output *out)
+{
+	Plain_State state = { .style = style, .indent = style->section_indent, .blank = true };
+	size_t base = style->section_indent;
+
+	for (size_t i = 0; i < section->commands_count; ++i) {
+		Command const* command = &section->commands[i];
+		bool tag = state.tag;
+
+		switch (command->type) {
+		break; case Text:
+			plain_start(&state, out);
+			plain_text(&state, sv_trim_right(command->value), false, out);
+			plain_end_line(&state, out);
+		break; case Link: {
+			String_View src = sv_trim(command->value);
+			String_View href = sv_trim(sv_chop_by_delim(&src, ' '));
+			src = sv_trim(src);
+			plain_start(&state, out);
+			if (style == &markdown_style) {
+				out_cstr(out, "["); plain_chars(&state, src, out); out_cstr(out, "]("); out_sv(out, href); out_cstr(out, ")");
+			} else {
+				plain_chars(&state, src, out);
+				if (src.count) {
+					out_cstr(out, " <");
+				}
+				plain_chars(&state, href, out);
+				if (src.count) {
+					out_cstr(out, ">");
+				}
+			}
+			plain_end_line(&state, out);
+		}
+		break; case Subsection:
+			state.indent = base;
+			plain_break(&state, out);
+			plain_start(&state, out);
+			out_cstr(out, style->subsection[0]);
+			plain_text(&state, command->value, false, out);
+			out_cstr(out, style->subsection[1]);
+			plain_break(&state, out);
+			tag = false;
+		break; case Paragraph: case Hanging_Paragraph: case List_Begin: case List_End:
+			state.indent = base;
+			plain_break(&state, out);
+			tag = false;
+		break; case Tagged_Paragraph: case Indented_Paragraph: case List_Item:
+			state.indent = base;
+			plain_break(&state, out);
+			plain_start(&state, out);
+			out_cstr(out, style->item);
+			state.body_indent = base + style->tag_indent;
+			if (command->type == Tagged_Paragraph) {
+				state.tag = true;
+			} else {
+				String_View args = command->value, arg;
+				if (command->type == List_Item) {
+					plain_inline(&state, args, out);
+				} else if (next_argument(&args, &arg)) {
+					plain_text(&state, arg, false, out);
+				}
+				plain_end_tag(&state, out);
+			}
+			tag = false;
+		break; case Indent:
+			base += style->block_indent;
+			state.indent = base;
+			plain_break(&state, out);
+			tag = false;
+		break; case Unindent:
+			base = base >= style->section_indent + style->block_indent ? base - style->block_indent : style->section_indent;
+			state.indent = base;
+			plain_break(&state, out);
+			tag = false;
+		break; case Bold: case Italic:
+		case Bold_Roman: case Italic_Roman: case Roman_Bold: case Roman_Italic: case Bold_Italic: case Italic_Bold:
+			plain_start(&state, out);
+			plain_fonts(&state, command, out);
+			plain_end_line(&state, out);
+		break; case No_Fill: case Fill:
+			tag = false;
+		break; case Preformatted:
+			plain_break(&state, out);
+			if (*style->code[0]) {
+				plain_start(&state, out);
+				out_cstr(out, style->code[0]);
+				state.line = false;
+			}
+			plain_start(&state, out);
+			plain_text(&state, command->value, true, out);
+			plain_end_line(&state, out);
+			if (*style->code[1]) {
+				plain_start(&state, out);
+				out_cstr(out, style->code[1]);
+			}
+			plain_break(&state, out);
+			tag = false;
+		break; case Name: case Description: case Inline:
+			plain_start(&state, out);
+			if (command->type == Description) {
+				out_cstr(out, "\u2014 ");
+			}
+			plain_inline(&state, command->value, out);
+			plain_end_line(&state, out);
+		// Includes are expanded by parse_page
+		break; case Include: case Command_Types: assert(0 && "unreachable");
+		}
+
+		// First line after .TP is its tag
+		if (tag) {
+			plain_end_tag(&state, out);
+		}
+	}
+}
+
+static bool print_plain_to(Plain_Style const* style, Page const* page, Output *out)
+{
+	if (style == &markdown_style) {
+		out_cstr(out, "# ");
+	}
+	out_sv(out, page->title[0]);
+	out_cstr(out, "(");
+	out_sv(out, page->title[1]);
+	out_cstr(out, ")\n");
+
+	Plain_State state = { .style = style };
+	for (size_t i = 0; i < page->sections_count; ++i) {
+		out_cstr(out, style == &markdown_style ? "\n## " : "\n");
+		plain_text(&state, page->sections[i].name, false, out);
+		out_cstr(out, "\n");
+		if (style == &markdown_style) {
+			out_cstr(out, "\n");
+		}
+		plain_section(style, &page->sections[i], out);
+	}
+	return !out->failed;
+}
+
+// Plain backends take configuration only to share signature of backends, nothing of it applies to them
+static bool print_text_to(Msg_Config const* config, Page const* page, Output *out)
+{
+	(void)config;
+	return print_plain_to(&text_style, page, out);
+}
+
+static bool print_markdown_to(Msg_Config const* config, Page const* page, Output *out)
+{
+	(void)config;
+	return print_plain_to(&markdown_style, page, out);
+}
+
+static bool print_json_to(Msg_Config const* config, Page const* page, Output *out)
+{
+	(void)config;
+	static char const* const title_names[Title_Fields] = {
+		"title", "section", "date", "source", "manual-section"
+	};
+	Plain_State state = { .style = &json_style };
+
+	out_cstr(out, "{\"title\":{");
+	for (size_t i = 0; i < Title_Fields; ++i) {
+		out_cstr(out, i ? ",\"" : "\""); out_cstr(out, title_names[i]); out_cstr(out, "\":\"");
+		plain_chars(&state, page->title[i], out);
+		out_cstr(out, "\"");
+	}
+	out_cstr(out, "},\"sections\":[");
+	for (size_t i = 0; i < page->sections_count; ++i) {
+		out_cstr(out, i ? ",\n{\"name\":\"" : "\n{\"name\":\"");
+		plain_text(&state, page->sections[i].name, false, out);
+		out_cstr(out, "\",\"text\":\"");
+		plain_section(&json_style, &page->sections[i], out);
+		out_cstr(out, "\"}");
+	}
+	out_cstr(out, "]}\n");
+	return !out->failed;
+}
+
+// Backends of formats, all rendering whole page into slices of out
+static struct {
+	char const* name;
+	char const* extension;
+	bool (*render)(Msg_Config const* config, Page const* page, Output *out);
+} const backends[Msg_Formats] = {
+	[Msg_Html]     = { "html",     ".html", print_page_to },
+	[Msg_Text]     = { "text",     ".txt",  print_text_to },
+	[Msg_Markdown] = { "markdown", ".md",   print_markdown_to },
+	[Msg_Json]     = { "json",     ".json", print_json_to },
+};
+
+MSGDEF bool render_page_as(Msg_Config const* config, Msg_Format format, Page const* page, Output *out)
+{
+	assert(format < Msg_Formats);
+	return backends[format].render(config, page, out);
+}
+
+MSGDEF Msg_Format msg_format_from_name(String_View name)
+{
+	Msg_Format format = 0;
+	while (format < Msg_Formats && !sv_eq(name, sv_from_cstr(backends[format].name))) {
+		++format;
+	}
+	return format;
+}
+
+MSGDEF char const* msg_format_extension(Msg_Format format)
+{
+	assert(format < Msg_Formats);
+	return backends[format].extension;
+}
+
+MSGDEF bool print_index_to(Msg_Config const* config, Index_Entry const* entries, size_t count, Output *out)
+{
+	print_head(config, SV("index"), out);
+
+	out_cstr(out, "<header>"); emit(config, out, "\n", "");
+	out_cstr(out, "<div>index</div>"); emit(config, out, "\n", "");
+	out_cstr(out, "<div><h1>index</h1></div>"); emit(config, out, "\n", "");
+	out_cstr(out, "<div>index</div>"); emit(config, out, "\n", "");
+	out_cstr(out, "</header>"); emit(config, out, "\n", "");
+
+	out_cstr(out, "<section>"); emit(config, out, "\n", "");
+	out_cstr(out, "<h2>PAGES</h2>");
+	for (size_t i = 0; i < count; ++i) {
+		Index_Entry const* entry = &entries[i];
+		out_cstr(out, "<div><a href=\""); out_sv(out, entry->href); out_cstr(out, "\">");
+		out_sv(out, entry->name); out_cstr(out, "("); out_sv(out, entry->section); out_cstr(out, ")</a>");
+		if (entry->description.count) {
+			out_cstr(out, " - "); out_sv(out, entry->description);
+		}
+		out_cstr(out, "</div>"); emit(config, out, "\n", "");
+	}
+	out_cstr(out, "</section>"); emit(config, out, "\n", "");
+
+	print_foot(config, out);
+	return !out->failed;
+}
+
+// Writes text escaped for XML, keeping runs without special characters as single slice.
+static void print_xml_text(String_View text, Output *out)
+{
+	size_t start = 0;
+	for (size_t i = 0; i < text.count; ++i) {
+		char const* entity = NULL;
+		switch (text.data[i]) {
+		break; case '&':  entity = "&amp;";
+		break; case '<':  entity = "&lt;";
+		break; case '>':  entity = "&gt;";
+		break; case '"':  entity = "&quot;";
+		break; case '\'': entity = "&apos;";
+		}
+		if (entity) {
+			out_sv(out, sv_from_parts(text.data + start, i - start));
+			out_cstr(out, entity);
+			start = i + 1;
+		}
+	}
+	out_sv(out, sv_from_parts(text.data + start, text.count - start));
+}
+
+static void print_entry_url(Msg_Config const* config, Index_Entry const* entry, Output *out)
+{
+	print_xml_text(sv_from_cstr(config->base_url), out);
+	out_cstr(out, "/");
+	print_xml_text(entry->href, out);
+}
+
+// Only dates in YYYY-MM-DD form are understood, others are too ambiguous to order or publish.
+static bool is_iso_date(String_View date)
+{
+	if (date.count != 10 || date.data[4] != '-' || date.data[7] != '-') {
+		return false;
+	}
+	for (size_t i = 0; i < date.count; ++i) {
+		if (i != 4 && i != 7 && !isdigit((unsigned char)date.data[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+MSGDEF bool print_sitemap_to(Msg_Config const* config, Index_Entry const* entries, size_t count, Output *out)
+{
+	out_cstr(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	out_cstr(out, "<urlset xmlns=\"http://www.sitemaps.org/schemas/sitemap/0.9\">\n");
+	for (size_t i = 0; i < count; ++i) {
+		out_cstr(out, "<url><loc>"); print_entry_url(config, &entries[i], out); out_cstr(out, "</loc>");
+		if (is_iso_date(entries[i].date)) {
+			out_cstr(out, "<lastmod>"); out_sv(out, entries[i].date); out_cstr(out, "</lastmod>");
+		}
+		out_cstr(out, "</url>\n");
+	}
+	out_cstr(out, "</urlset>\n");
+	return !out->failed;
+}
+
+MSGDEF bool print_sitemap_index_to(Msg_Config const* config, size_t count, Output *out)
+{
+	out_cstr(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	out_cstr(out, "<sitemapindex xmlns=\"http://www.sitemaps.org/schemas/sitemap/0.9\">\n");
+	for (size_t i = 0; i < count; ++i) {
+		out_cstr(out, "<sitemap><loc>"); print_xml_text(sv_from_cstr(config->base_url), out);
+		char *name = out_reserve(out, 48);
+		out_sv(out, sv_from_parts(name, snprintf(name, 48, "/sitemap-%zu.xml", i + 1)));
+		out_cstr(out, "</loc></sitemap>\n");
+	}
+	out_cstr(out, "</sitemapindex>\n");
+	return !out->failed;
+}
+
+static bool entry_newer(Index_Entry const* a, Index_Entry const* b)
+{
+	int order = memcmp(a->date.data, b->date.data, 10);
+	if (order != 0) {
+		return order > 0;
+	}
+	// Among pages of the same day, ones earlier in order of entries come first
+	return a < b;
+}
+
+// Most recent entries are selected with min-heap of Msg_Feed_Limit entries,
+// so feed costs single pass over entries regardless of their order.
+MSGDEF bool print_feed_to(Msg_Config const* config, Index_Entry const* entries, size_t count, Output *out)
+{
+	Index_Entry const* heap[Msg_Feed_Limit];
+	size_t heap_count = 0;
+	for (size_t i = 0; i < count; ++i) {
+		Index_Entry const* entry = &entries[i];
+		if (!is_iso_date(entry->date)) {
+			continue;
+		}
+		size_t k;
+		if (heap_count < Msg_Feed_Limit) {
+			for (k = heap_count++; k > 0 && entry_newer(heap[(k-1)/2], entry); k = (k-1)/2) {
+				heap[k] = heap[(k-1)/2];
+			}
+		} else if (entry_newer(entry, heap[0])) {
+			for (k = 0;;) {
+				size_t child = 2*k + 1;
+				if (child >= heap_count) {
+					break;
+				}
+				if (child + 1 < heap_count && entry_newer(heap[child], heap[child+1])) {
+					++child;
+				}
+				if (!entry_newer(entry, heap[child])) {
+					break;
+				}
+				heap[k] = heap[child];
+				k = child;
+			}
+		} else {
+			continue;
+		}
+		heap[k] = entry;
+	}
+
+	// Sorting heap in place leaves entries from the most recent
+	for (size_t n = heap_count; n > 1; --n) {
+		Index_Entry const* oldest = heap[0];
+		Index_Entry const* last = heap[n-1];
+		size_t k = 0;
+		for (;;) {
+			size_t child = 2*k + 1;
+			if (child >= n - 1) {
+				break;
+			}
+			if (child + 1 < n - 1 && entry_newer(heap[child], heap[child+1])) {
+				++child;
+			}
+			if (!entry_newer(last, heap[child])) {
+				break;
+			}
+			heap[k] = heap[child];
+			k = child;
+		}
+		heap[k] = last;
+		heap[n-1] = oldest;
+	}
+
+	out_cstr(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	out_cstr(out, "<feed xmlns=\"http://www.w3.org/2005/Atom\">\n");
+	out_cstr(out, "<id>"); print_xml_text(sv_from_cstr(config->base_url), out); out_cstr(out, "/</id>\n");
+	out_cstr(out, "<title>"); print_xml_text(sv_from_cstr(config->base_url), out); out_cstr(out, "</title>\n");
+	out_cstr(out, "<link rel=\"self\" href=\""); print_xml_text(sv_from_cstr(config->base_url), out); out_cstr(out, "/feed.atom\"/>\n");
+	out_cstr(out, "<author><name>"); print_xml_text(sv_from_cstr(config->base_url), out); out_cstr(out, "</name></author>\n");
+	out_cstr(out, "<updated>");
+	out_sv(out, heap_count ? heap[0]->date : SV("1970-01-01"));
+	out_cstr(out, "T00:00:00Z</updated>\n");
+
+	for (size_t i = 0; i < heap_count; ++i) {
+		Index_Entry const* entry = heap[i];
+		out_cstr(out, "<entry>\n");
+		out_cstr(out, "<id>"); print_entry_url(config, entry, out); out_cstr(out, "</id>\n");
+		out_cstr(out, "<title>"); print_xml_text(entry->name, out);
+		out_cstr(out, "("); print_xml_text(entry->section, out); out_cstr(out, ")</title>\n");
+		out_cstr(out, "<link href=\""); print_entry_url(config, entry, out); out_cstr(out, "\"/>\n");
+		out_cstr(out, "<updated>"); out_sv(out, entry->date); out_cstr(out, "T00:00:00Z</updated>\n");
+		if (entry->description.count) {
+			out_cstr(out, "<summary>"); print_xml_text(entry->description, out); out_cstr(out, "</summary>\n");
+		}
+		out_cstr(out, "</entry>\n");
+	}
+	out_cstr(out, "</feed>\n");
+	return !out->failed;
+}
+
+// Line of NAME section is "names - one-liner", or .Nm names followed by .Nd one-liner in mdoc.
+static void split_name_section(Page const* page, String_View *names, String_View *description)
+{
+	*names = *description = SV_NULL;
+	for (size_t i = 0; i < page->sections_count; ++i) {
+		Section const* section = &page->sections[i];
+		// Generators like asciidoc and docbook quote every heading, as in .SH "NAME"
+		String_View name = sv_trim(section->name);
+		if (name.count >= 2 && name.data[0] == '"' && name.data[name.count - 1] == '"') {
+			name = sv_from_parts(name.data + 1, name.count - 2);
+		}
+		if (!sv_eq_ignorecase(name, SV("NAME"))) {
+			continue;
+		}
+
+		for (size_t j = 0; j < section->commands_count; ++j) {
+			String_View line = sv_trim(section->commands[j].value);
+			if (section->commands[j].type == Name && !names->data) {
+				*names = line;
+				continue;
+			}
+			if (section->commands[j].type == Description) {
+				*description = line;
+				return;
+			}
+			if (section->commands[j].type != Text || line.count == 0) {
+				continue;
+			}
+			for (size_t k = 0; k + 1 < line.count; ++k) {
+				// Names may take several lines, with dash starting the last one
+				if (line.data[k+1] == '-' && (line.data[k] == ' ' || line.data[k] == '\n' || line.data[k] == '\\')) {
+					*names = sv_trim(sv_from_parts(line.data, k));
+					sv_chop_left(&line, k + 2);
+					*description = sv_trim(line);
+					return;
+				}
+			}
+			*description = line;
+			return;
+		}
+		break;
+	}
+}
+
+// One-liner of page is text of its NAME section after "name - " part.
+MSGDEF String_View page_description(Page const* page)
+{
+	String_View names, description;
+	split_name_section(page, &names, &description);
+	return description;
+}
+
+MSGDEF String_View page_names(Page const* page)
+{
+	String_View names, description;
+	split_name_section(page, &names, &description);
+	return names;
+}
+
+MSGDEF bool render_page(Msg_Config const* config, Page const* page, Msg_Buffer *buffer)
+{
+	Output out = { .buffer = buffer };
+	bool ok = print_page_to(config, page, &out);
+	out_free(&out);
+	return ok;
+}
+
+MSGDEF bool render_stylesheet(Msg_Config const* config, Msg_Buffer *buffer)
+{
+	Output out = { .buffer = buffer };
+	print_root_colors(config, &out);
+	emit(config, &out, "\n", "");
+	out_sv(&out, config->theme);
+	return !out.failed;
+}
+
+// Removes comments and whitespace that doesn't change meaning of stylesheet.
+// Whitespace is dropped around {};,> and after :, other runs of whitespace
+// collapse into single space, since they may separate selectors or values.
+// Strings are copied verbatim.
+MSGDEF String_View minify_css(String_View css)
+{
+	char *result = malloc(css.count + 1);
+	if (!result) {
+		return SV_NULL;
+	}
+	size_t count = 0;
+	bool pending_space = false;
+
+	for (size_t i = 0; i < css.count;) {
+		char c = css.data[i];
+
+		if (c == '/' && i+1 < css.count && css.data[i+1] == '*') {
+			for (i += 2; i+1 < css.count && !(css.data[i] == '*' && css.data[i+1] == '/'); ++i) {}
+			i += 2;
+			pending_space = true;
+			continue;
+		}
+
+		if (isspace((unsigned char)c)) {
+			pending_space = true;
+			++i;
+			continue;
+		}
+
+		bool punctuation = strchr("{};,>", c) != NULL;
+		if (pending_space && count > 0 && !punctuation && !strchr("{};,>:", result[count-1])) {
+			result[count++] = ' ';
+		}
+		pending_space = false;
+
+		if (c == '}' && count > 0 && result[count-1] == ';') {
+			--count;
+		}
+
+		if (c == '"' || c == '\'') {
+			size_t start = i++;
+			for (; i < css.count && css.data[i] != c; ++i) {
+				// Escaped character is skipped, unless backslash ends unterminated string
+				i += css.data[i] == '\\' && i + 1 < css.count;
+			}
+			i = i < css.count ? i + 1 : css.count;
+			memcpy(result + count, css.data + start, i - start);
+			count += i - start;
+			continue;
+		}
+
+		result[count++] = c;
+		++i;
+	}
+
+	result[count] = '\0';
+	return (String_View) { .data = result, .count = count };
+}
+
+static void out_copy(Output *out, String_View sv)
+{
+	Msg_Buffer *buffer = out->buffer;
+	if (buffer->count + sv.count > buffer->capacity) {
+		size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+		while (capacity < buffer->count + sv.count) {
+			capacity *= 2;
+		}
+		char *data = realloc(buffer->data, capacity);
+		if (!data) {
+			out->failed = true;
+			return;
+		}
+		buffer->data = data;
+		buffer->capacity = capacity;
+	}
+	memcpy(buffer->data + buffer->count, sv.data, sv.count);
+	buffer->count += sv.count;
+}
+
+MSGDEF void out_sv(Output *out, String_View sv)
+{
+	if (sv.count == 0 || out->failed) {
+		return;
+	}
+	out->bytes += sv.count;
+	if (out->buffer) {
+		out_copy(out, sv);
+		return;
+	}
+	if (out->parts_count > 0) {
+		struct iovec *last = Back(*out, parts);
+		if ((char const*)last->iov_base + last->iov_len == sv.data) {
+			last->iov_len += sv.count;
+			return;
+		}
+	}
+	Push(*out, parts);
+	*Back(*out, parts) = (struct iovec) { .iov_base = (void*)sv.data, .iov_len = sv.count };
+}
+
+MSGDEF void out_cstr(Output *out, char const* cstr)
+{
+	out_sv(out, sv_from_cstr(cstr));
+}
+
+MSGDEF void out_advance(Output *out, size_t written)
+{
+	while (written > 0) {
+		struct iovec *part = &out->parts[out->parts_written];
+		if (written < part->iov_len) {
+			part->iov_base = (char*)part->iov_base + written;
+			part->iov_len -= written;
+			return;
+		}
+		written -= part->iov_len;
+		++out->parts_written;
+	}
+}
+
+MSGDEF bool out_write(Output *out, int fd)
+{
+	while (out->parts_written < out->parts_count) {
+		size_t remaining = out->parts_count - out->parts_written;
+		ssize_t written = writev(fd, out->parts + out->parts_written, remaining < IOV_MAX ? remaining : IOV_MAX);
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+		if (written <= 0) {
+			return false;
+		}
+		out_advance(out, written);
+	}
+	return true;
+}
+
+MSGDEF char* out_reserve(Output *out, size_t size)
+{
+	if (out->blocks_count == 0 || out->block_used + size > Output_Block_Size) {
+		Push(*out, blocks);
+		*Back(*out, blocks) = malloc(size > Output_Block_Size ? size : Output_Block_Size);
+		assert(*Back(*out, blocks));
+		out->block_used = 0;
+	}
+	char *result = *Back(*out, blocks) + out->block_used;
+	out->block_used += size;
+	return result;
+}
+
+MSGDEF void out_free(Output *out)
+{
+	for (size_t i = 0; i < out->blocks_count; ++i) {
+		free(out->blocks[i]);
+	}
+	free(out->blocks);
+	free(out->parts);
+	*out = (Output) {0};
+}
+
+MSGDEF void ensure_enough_space(void **mem, size_t element_size, size_t desired_count, size_t *capacity)
+{
+	if (desired_count < *capacity) {
+		return;
+	}
+
+	size_t new_capacity = *capacity > 0 ? desired_count * 2 : 8;
+
+	*mem = *mem ? realloc(*mem, new_capacity * element_size) : malloc(new_capacity * element_size);
+	assert(*mem);
+
+	void *old_end = *mem + element_size * *capacity;
+	memset(old_end, 0, (new_capacity - *capacity) * element_size);
+	*capacity = new_capacity;
+}
+
+#endif // MSG_IMPLEMENTATION